@@ -30,6 +30,9 @@ Adafruit_ILI9341 tft = Adafruit_ILI9341(TFT_CS, TFT_DC);
 // Graphics setup
 G3D draw(tft,0,0,tft.width(),tft.height());
 
+// Segments drawn last frame, so we can erase them
+static G3DSegment damage[16];
+
 #elif USELIBRARY == 2
 
 Arduboy arduboy;
@@ -47,6 +50,8 @@ void setup()
 {
 #if USELIBRARY == 1
     tft.begin();
+    tft.fillScreen(ILI9341_BLACK);
+    draw.setDamageBuffer(damage,16);
 #elif USELIBRARY == 2
     arduboy.beginNoLogo();
     arduboy.setFrameRate(50);
@@ -90,8 +95,6 @@ void drawBox(int x, int y, int z)
 #if USELIBRARY == 1
 void loop() 
 {
-    tft.fillScreen(ILI9341_BLACK);
-
     draw.begin();
     draw.setColor(ILI9341_RED);
     transform();
@@ -100,9 +103,9 @@ void loop()
 
     delay(100);
     
+    // Erase what we drew without running it through the pipeline again
     draw.begin();
-    draw.setColor(ILI9341_BLACK);
-    drawBox(0,0,0); 
+    draw.erase(ILI9341_BLACK);
     draw.end();   
     
     GXAngle += 0.01;
@@ -3,8 +3,95 @@
  *      3D drawing pipeline for the Arduino.
  */
 
+#include <math.h>
 #include "G3D.h"
 
+/********************************************************************/
+/*                                                                  */
+/*  Statistics														*/
+/*                                                                  */
+/********************************************************************/
+
+/*
+ *	G3D_COUNT adds to one of the G3DStats counters. G3D_STAGE marks the
+ *	rest of the enclosing block as time spent in stage n; time is moved
+ *	from stage to stage as we enter and leave each one, so the stage
+ *	totals add up to the time spent in the pipeline even when a clock
+ *	tick (4us with micros() on the AVR) is longer than a call.
+ */
+
+#if G3D_STATS > 0
+#define G3D_COUNT(c,n)		(stats.c += (n))
+#else
+#define G3D_COUNT(c,n)		((void)0)
+#endif
+
+#if G3D_STATS > 1
+
+static inline G3DTicks StatsTicks()
+{
+#if defined(ARDUINO)
+	return micros();
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+class G3DStageScope
+{
+	public:
+		G3DStageScope(G3D &g, uint8_t stage) : g3d(g)
+			{
+				old = g3d.enterStage(stage);
+			}
+		~G3DStageScope()
+			{
+				g3d.enterStage(old);
+			}
+
+	private:
+		G3D		&g3d;
+		uint8_t	old;
+};
+
+#define G3D_STAGE(n)		G3DStageScope stageScope(*this,n)
+
+/*	G3D::enterStage
+ *
+ *		Charge the time since the last change of stage to the stage we
+ *	were in, and move to the new stage. Returns the old stage.
+ */
+
+uint8_t G3D::enterStage(uint8_t stage)
+{
+	uint8_t old = statsStage;
+	if (stage != old) {
+		G3DTicks now = StatsTicks();
+		if (old) stats.time[old - 1] += now - statsMark;
+		statsMark = now;
+		statsStage = stage;
+	}
+	return old;
+}
+
+#else
+#define G3D_STAGE(n)
+#endif
+
+#if G3D_STATS > 0
+
+/*	G3D::clearStats
+ *
+ *		Zero the statistics, typically at the start of each frame
+ */
+
+void G3D::clearStats()
+{
+	memset(&stats,0,sizeof(stats));
+}
+
+#endif
+
 /********************************************************************/
 /*                                                                  */
 /*  Constructor/Destructor											*/
@@ -20,12 +107,43 @@
 G3D::G3D(Adafruit_GFX &l, uint16_t x, uint16_t y, uint16_t w, uint16_t h) : lib(l)
 #elif USELIBRARY == 2
 G3D::G3D(Arduboy &l, uint16_t x, uint16_t y, uint16_t w, uint16_t h) : lib(l)
+#elif USELIBRARY == 3
+G3D::G3D(G3DFrameBuffer &l, uint16_t x, uint16_t y, uint16_t w, uint16_t h) : lib(l)
 #endif
 {
 	xoffset = x;
 	yoffset = y;
 	width = w;
 	height = h;
+
+	color = 0;
+#if G3D_STACKDEPTH > 0
+	stackDepth = 0;
+#endif
+	meshBuffer = NULL;
+	meshBufferSize = 0;
+	faceBuffer = NULL;
+	faceBufferSize = 0;
+#if G3D_STATS > 0
+	clearStats();
+#endif
+#if G3D_STATS > 1
+	statsStage = 0;
+	statsMark = 0;
+#endif
+	damage = NULL;
+	damageSize = 0;
+	clearDamage();
+#if G3D_BANDS > 0
+	bandBuffer = NULL;
+	bandSize = 0;
+	bandRows = G3D_BANDHEIGHT(h);
+	clearBands();
+#endif
+#if G3D_PARALLEL
+	p1capture = NULL;
+	p1captureCount = 0;
+#endif
 	
 	/* Initialize components of pipeline */
 	p1init();
@@ -43,53 +161,86 @@ G3D::~G3D()
 /*                                                                  */
 /********************************************************************/
 
-void G3D::translate(float x, float y, float z)
+void G3D::translate(G3DScalar x, G3DScalar y, G3DScalar z)
 {
-	G3DMatrix m;
-	m.setTranslate(x,y,z);
-	transformation.multiply(m);
+	transformation.translate(x,y,z);
 }
 
-void G3D::scale(float x, float y, float z)
+void G3D::scale(G3DScalar x, G3DScalar y, G3DScalar z)
 {
-	G3DMatrix m;
-	m.setScale(x,y,z);
-	transformation.multiply(m);
+	transformation.scale(x,y,z);
 }
 
-void G3D::scale(float x)
+void G3D::scale(G3DScalar x)
 {
-	G3DMatrix m;
-	m.setScale(x);
-	transformation.multiply(m);
+	transformation.scale(x);
 }
 
-void G3D::rotate(uint8_t axis, float angle)
+void G3D::rotate(uint8_t axis, G3DScalar angle)
 {
-	G3DMatrix m;
-	m.setRotate(axis, angle);
-	transformation.multiply(m);
+	transformation.rotate(axis,angle);
+}
+
+void G3D::rotateAngle(uint8_t axis, G3DAngle angle)
+{
+	transformation.rotateAngle(axis,angle);
 }
 
-void G3D::perspective(float fov, float near)
+void G3D::perspective(G3DScalar fov, G3DScalar near)
 {
 	G3DMatrix m;
 	m.setPerspective(fov,near);
 	transformation.multiply(m);
 	
 	// Handle our screen's aspect ratio, so our output screen is -1,1 in X and y
-	m.setScale(1.0/p2xsize,1.0/p2ysize,1);
-	transformation.multiply(m);
+	transformation.scale(G3DScalar(1)/p2xsize,G3DScalar(1)/p2ysize,1);
 }
 
 void G3D::orthographic()
 {
-	G3DMatrix m;
-	m.setIdentity();
-	m.a[0][0] = 1.0/p2xsize;
-	m.a[1][1] = 1.0/p2ysize;
-	m.a[2][2] = 0;		// Flatten z
-	transformation.multiply(m);
+	// Flatten z
+	transformation.scale(G3DScalar(1)/p2xsize,G3DScalar(1)/p2ysize,0);
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Matrix Stack													*/
+/*                                                                  */
+/********************************************************************/
+
+/*	G3D::push
+ *
+ *		Save a copy of the current transformation. This allows a parent
+ *	transformation to be calculated once and shared by several parts.
+ *	Returns false if the stack is full, in which case nothing is saved.
+ */
+
+bool G3D::push()
+{
+#if G3D_STACKDEPTH > 0
+	if (stackDepth >= G3D_STACKDEPTH) return false;
+	stack[stackDepth++] = transformation;
+	return true;
+#else
+	return false;
+#endif
+}
+
+/*	G3D::pop
+ *
+ *		Restore the last saved transformation. Returns false if the stack
+ *	is empty, in which case the transformation is unchanged.
+ */
+
+bool G3D::pop()
+{
+#if G3D_STACKDEPTH > 0
+	if (stackDepth == 0) return false;
+	transformation = stack[--stackDepth];
+	return true;
+#else
+	return false;
+#endif
 }
 
 /********************************************************************/
@@ -101,11 +252,16 @@ void G3D::orthographic()
 /*	G3D::begin
  *
  *		Because we do a lot of drawing to draw a screen, we block out
- *	the begin/end calls (if required)
+ *	the begin/end calls (if required). When drawing in bands this also
+ *	forgets the segments recorded for the last frame.
  */
 
 void G3D::begin()
 {
+#if G3D_BANDS > 0
+	clearBands();
+#endif
+
 #if USELIBRARY == 1
 	lib.startWrite();
 #endif
@@ -113,11 +269,13 @@ void G3D::begin()
 
 /*	G3D::end
  *
- *		End writing block
+ *		End writing block. This flushes any pending polyline.
  */
 
 void G3D::end()
 {
+	p1flush();
+
 #if USELIBRARY == 1
 	lib.endWrite();
 #endif
@@ -125,31 +283,213 @@ void G3D::end()
 
 /********************************************************************/
 /*                                                                  */
-/*  Move/Draw Support												*/
+/*  Damage Tracking													*/
 /*                                                                  */
 /********************************************************************/
 
-void G3D::p4movedraw(bool drawFlag, float x, float y, float z)
+/*	G3D::setDamageBuffer
+ *
+ *		Start recording everything drawn into buffer, which holds size
+ *	segments, so it can later be erased with erase(). Pass NULL to stop
+ *	recording.
+ */
+
+void G3D::setDamageBuffer(G3DSegment *buffer, uint16_t size)
 {
-    G3DVector t;
+	damage = buffer;
+	damageSize = buffer ? size : 0;
+	clearDamage();
+}
+
+/*	G3D::clearDamage
+ *
+ *		Forget everything recorded so far
+ */
+
+void G3D::clearDamage()
+{
+	damageCount = 0;
+	damageOverflow = false;
+	damageLeft = 0xFFFF;
+	damageTop = 0xFFFF;
+	damageRight = 0;
+	damageBottom = 0;
+}
+
+/*	G3D::erase
+ *
+ *		Erase everything drawn since the damage was last cleared by
+ *	drawing it again in the color c. The segments are replayed through
+ *	stage 1 only, so we hit exactly the same pixels without running the
+ *	rest of the pipeline. If we ran out of room recording segments, we
+ *	fill the bounding rectangle of everything drawn instead.
+ *
+ *		Like drawing, this should be done between begin() and end().
+ */
+
+void G3D::erase(uint16_t c)
+{
+	G3DSegment *d = damage;
+	if (d == NULL) return;
+
+	/*
+	 *	Turn off recording while we erase
+	 */
+
+	damage = NULL;
+#if USELIBRARY == 2
+	uint8_t oldColor = color;
+#else
+	uint16_t oldColor = color;
+#endif
+	setColor(c);
+
+	if (damageOverflow) {
+		p1flush();
+		if (damageLeft <= damageRight) {
+			p1fillrect(damageLeft,damageTop,damageRight - damageLeft + 1,damageBottom - damageTop + 1);
+		}
+	} else {
+		for (uint16_t i = 0; i < damageCount; ++i) {
+			const G3DSegment &seg = d[i];
+			if ((seg.x1 == seg.x2) && (seg.y1 == seg.y2)) {
+				p1point(seg.x1,seg.y1);
+			} else {
+				if (!p1draw || (seg.x1 != p1x) || (seg.y1 != p1y)) p1movedraw(false,seg.x1,seg.y1);
+				p1movedraw(true,seg.x2,seg.y2);
+			}
+		}
+	}
+
+	setColor(oldColor);
+	damage = d;
+	clearDamage();
+}
+
+#if G3D_BANDS > 0
+
+/********************************************************************/
+/*                                                                  */
+/*  Band Drawing													*/
+/*                                                                  */
+/********************************************************************/
+
+/*	G3D::setBandBuffer
+ *
+ *		Start drawing in bands. Everything drawn between begin() and
+ *	end() is recorded into buffer, which holds size segments, rather than
+ *	drawn; segments past the end of the buffer are dropped and reported
+ *	by bandOverflow(). Pass NULL to draw directly again.
+ *
+ *		The display buffer only needs to be bandHeight() rows high, and
+ *	holds one band at a time, with the band's top row in row 0.
+ */
+
+void G3D::setBandBuffer(G3DBandSegment *buffer, uint16_t size)
+{
+	p1flush();
+	bandBuffer = buffer;
+	bandSize = buffer ? size : 0;
+	clearBands();
+}
+
+/*	G3D::clearBands
+ *
+ *		Forget every recorded segment
+ */
+
+void G3D::clearBands()
+{
+	bandCount = 0;
+	bandDropped = false;
+	for (uint8_t i = 0; i < G3D_BANDS; ++i) {
+		bandHead[i] = G3D_NOSEGMENT;
+		bandTail[i] = G3D_NOSEGMENT;
+	}
+}
+
+/*	G3D::drawBand
+ *
+ *		Draw the segments which cross a band into the display buffer,
+ *	which the caller has cleared, and will then send to rows
+ *	band * bandHeight() onwards of the display. Bands must be drawn in
+ *	order, once each, after end().
+ *
+ *		Segments are drawn in the order they were recorded, so where
+ *	colors overlap the result matches drawing the frame directly. A
+ *	segment which carries on below this band is merged into the next
+ *	band's list, which is also in recorded order.
+ */
+
+void G3D::drawBand(uint8_t band)
+{
+	G3D_STAGE(1);
+
+	if ((bandBuffer == NULL) || (band >= G3D_BANDS)) return;
+
+	uint16_t top = band * bandRows;
+	uint16_t bottom = top + bandRows;
+	uint16_t *link = (band + 1 < G3D_BANDS) ? bandHead + band + 1 : NULL;
+
+	uint16_t i = bandHead[band];
+	while (i != G3D_NOSEGMENT) {
+		G3DBandSegment &seg = bandBuffer[i];
+		uint16_t next = seg.next;
+
+		p1band(seg,top,bottom);
+
+		if (link && ((seg.y1 >= bottom) || (seg.y2 >= bottom))) {
+			while ((*link != G3D_NOSEGMENT) && (*link < i)) {
+				link = &bandBuffer[*link].next;
+			}
+			seg.next = *link;
+			*link = i;
+			link = &seg.next;
+		}
+		i = next;
+	}
+	bandHead[band] = G3D_NOSEGMENT;
+}
+
+#endif
+
+/********************************************************************/
+/*                                                                  */
+/*  Move/Draw Support												*/
+/*                                                                  */
+/********************************************************************/
+
+/*	G3D::p4transform
+ *
+ *		Transform the point (x,y,z,1) by our transformation matrix
+ */
 
+inline void G3D::p4transform(G3DScalar x, G3DScalar y, G3DScalar z, G3DVector &t)
+{
+    G3D_COUNT(vertices,1);
     t.x = transformation.a[0][0] * x + transformation.a[0][1] * y + transformation.a[0][2] * z + transformation.a[0][3];
     t.y = transformation.a[1][0] * x + transformation.a[1][1] * y + transformation.a[1][2] * z + transformation.a[1][3];
     t.z = transformation.a[2][0] * x + transformation.a[2][1] * y + transformation.a[2][2] * z + transformation.a[2][3];
     t.w = transformation.a[3][0] * x + transformation.a[3][1] * y + transformation.a[3][2] * z + transformation.a[3][3];
+}
 
+void G3D::p4movedraw(bool drawFlag, G3DScalar x, G3DScalar y, G3DScalar z)
+{
+    G3D_STAGE(4);
+
+    G3DVector t;
+
+    p4transform(x,y,z,t);
     p3movedraw(drawFlag,t);
 }
 
-void G3D::p4point(float x, float y, float z)
+void G3D::p4point(G3DScalar x, G3DScalar y, G3DScalar z)
 {
-    G3DVector t;
+    G3D_STAGE(4);
 
-    t.x = transformation.a[0][0] * x + transformation.a[0][1] * y + transformation.a[0][2] * z + transformation.a[0][3];
-    t.y = transformation.a[1][0] * x + transformation.a[1][1] * y + transformation.a[1][2] * z + transformation.a[1][3];
-    t.z = transformation.a[2][0] * x + transformation.a[2][1] * y + transformation.a[2][2] * z + transformation.a[2][3];
-    t.w = transformation.a[3][0] * x + transformation.a[3][1] * y + transformation.a[3][2] * z + transformation.a[3][3];
+    G3DVector t;
 
+    p4transform(x,y,z,t);
     p3point(t);
 }
 
@@ -180,6 +520,23 @@ static uint8_t OutCode(const G3DVector &v)
     return m;
 }
 
+#if G3D_GUARDBAND > 0
+
+/*	InGuardBand
+ *
+ *		True if the vector is within the guard band in x and y. Only
+ *	used on vectors already known to be between the near and far planes.
+ */
+
+static inline bool InGuardBand(const G3DVector &v)
+{
+    G3DScalar band = G3DScalar(G3D_GUARDBAND) * v.w;
+
+    return (v.w > 0) && (v.x >= -band) && (v.x <= band) && (v.y >= -band) && (v.y <= band);
+}
+
+#endif
+
 /*	Lerp
  *
  *		Perform linear interpolation; given two values (a and b) and
@@ -188,9 +545,9 @@ static uint8_t OutCode(const G3DVector &v)
  *		This is used to find the intersection of the vector with a wall
  */
 
-static void Lerp(const G3DVector &a, const G3DVector &b, float alpha, G3DVector &c)
+static void Lerp(const G3DVector &a, const G3DVector &b, G3DScalar alpha, G3DVector &c)
 {
-    float a1 = 1.0f - alpha;
+    G3DScalar a1 = G3DScalar(1) - alpha;
     c.x = a1 * a.x + alpha * b.x;
     c.y = a1 * a.y + alpha * b.y;
     c.z = a1 * a.z + alpha * b.z;
@@ -209,6 +566,7 @@ void G3D::p3init()
 	p3pos.z = 0;
 	p3pos.w = 1;
 	p3outcode = 0;
+	p3clip = true;
 }
 
 /*	G3D::p3point
@@ -220,19 +578,45 @@ void G3D::p3init()
 
 void G3D::p3point(const G3DVector &v)
 {
-	if (!OutCode(v)) {
+	G3D_STAGE(3);
+
+	if (!p3clip || !OutCode(v)) {
 		p2point(v.x/v.w, v.y/v.w);
 	}
 }
 
-/*	G3D::p3init
+/*	G3D::p3movedraw
  *
- *		Initialize
+ *		Move or draw to the transformed vector v, clipping the line from
+ *	the previous location against our view volume.
  */
 
 void G3D::p3movedraw(bool drawFlag, const G3DVector &v)
 {
-    uint8_t newOutCode = OutCode(v);
+    G3D_STAGE(3);
+
+    if (p3clip) {
+        p3movedraw(drawFlag,v,OutCode(v));
+    } else {
+        // Clipping disabled; the caller has determined everything
+        // is inside our view volume.
+        if (drawFlag) G3D_COUNT(accepted,1);
+        p2movedraw(drawFlag,v.x/v.w,v.y/v.w);
+    }
+}
+
+/*	G3D::p3movedraw
+ *
+ *		Move or draw, with the outcode for v precalculated by the caller.
+ */
+
+void G3D::p3movedraw(bool drawFlag, const G3DVector &v, uint8_t newOutCode)
+{
+    G3D_STAGE(3);
+
+    // Clipping was off, so there is no point to draw from
+    if (p3outcode == G3D_NOPOINT) drawFlag = false;
+
     G3DVector lerp;
     if (drawFlag) {
         uint8_t mask = newOutCode | p3outcode;
@@ -241,12 +625,24 @@ void G3D::p3movedraw(bool drawFlag, const G3DVector &v)
          *  Fast accept/reject
          */
 
-        if (0 == (newOutCode & p3outcode)) {
+        if (newOutCode & p3outcode) {
+            // Fast reject. Both points are beyond the same wall
+            G3D_COUNT(rejected,1);
+        } else {
             if (0 == mask) {
                 // Fast accept. Both points are inside; we assume
                 // the previous point was already passed upwards, 
                 // so we only draw to the current vector location
+                G3D_COUNT(accepted,1);
                 p2movedraw(true,v.x/v.w,v.y/v.w);
+#if G3D_GUARDBAND > 0
+            } else if (!(mask & 0x30) && InGuardBand(p3pos) && InGuardBand(v)) {
+                // The line only crosses the sides of the view, and
+                // both ends are close enough to project safely; clip
+                // it in screen space instead.
+                G3D_COUNT(guardBand,1);
+                p2clipdraw(p3outcode != 0,p3pos.x/p3pos.w,p3pos.y/p3pos.w,v.x/v.w,v.y/v.w);
+#endif
             } else {
                 // At this point we have a line that crosses
                 // a boundary. We calculate the alpha between
@@ -255,9 +651,9 @@ void G3D::p3movedraw(bool drawFlag, const G3DVector &v)
                 // (This is the Liang-Barsky optimization of
                 // the Cohen-Sutherland algorithm)
 
-                float aold = 0;     // (1 - alpha) * old + alpha * new = v
-                float anew = 1;     // in the above, 0 == old, 1 == new.
-                float alpha;
+                G3DScalar aold = 0; // (1 - alpha) * old + alpha * new = v
+                G3DScalar anew = 1; // in the above, 0 == old, 1 == new.
+                G3DScalar alpha;
 
                 uint8_t m = 1;
                 uint8_t i;
@@ -272,6 +668,7 @@ void G3D::p3movedraw(bool drawFlag, const G3DVector &v)
                         // and with alpha as a linear scale with the intersection
                         // point sliding from old to new.
 
+                        G3D_COUNT(divisions,1);
                         switch (i) {
                             default:
                             case 0:         // clip (1,0,0,1)
@@ -300,6 +697,13 @@ void G3D::p3movedraw(bool drawFlag, const G3DVector &v)
                                 break;
                         }
 
+#if G3DSCALAR != G3D_FLOAT
+                        // Rounding in fixed point can push alpha just
+                        // outside of 0 to 1; pin it so we never extrapolate
+                        if (alpha < 0) alpha = 0;
+                        if (alpha > 1) alpha = 1;
+#endif
+
                         if (p3outcode & m) {
                             if (aold < alpha) aold = alpha;
                         } else {
@@ -310,6 +714,7 @@ void G3D::p3movedraw(bool drawFlag, const G3DVector &v)
                             // We have a case where the line is not visible
                             // because it's outside the visible frustrum.
                             // abort.
+                            G3D_COUNT(rejected,1);
                             break;
                         }
                     }
@@ -318,6 +723,7 @@ void G3D::p3movedraw(bool drawFlag, const G3DVector &v)
 
                 if (i >= 6) {
                     // Ran all clipping edges.
+                    G3D_COUNT(clipped,1);
                     if (p3outcode) {
                         Lerp(p3pos,v,aold,lerp);
 						p2movedraw(false,lerp.x/lerp.w,lerp.y/lerp.w);
@@ -345,126 +751,1340 @@ void G3D::p3movedraw(bool drawFlag, const G3DVector &v)
 
 /********************************************************************/
 /*                                                                  */
-/*  Move/Draw Level 2												*/
+/*  Object Culling													*/
 /*                                                                  */
 /********************************************************************/
 
-/*	G3D::p2init
+/*	G3D::cullSphere
  *
- *		Initialize p2 framework
+ *		Classify a bounding sphere in model coordinates against our view
+ *	volume. Each clipping wall is a plane in clip space (for example,
+ *	x + w >= 0); multiplying it by our transformation gives the same
+ *	plane in model space, which we compare with the sphere directly.
+ *
+ *		The distance of the center from each plane is compared with the
+ *	radius directly, with no squares to overflow in fixed point. Both
+ *	are scaled by the length of the plane normal; rather than take a
+ *	square root we use max + (mid + min) / 2 of the components'
+ *	magnitudes, which is never less than the length and at most 15%
+ *	more. Overestimating the radius can only turn a G3D_INSIDE or
+ *	G3D_OUTSIDE result into G3D_PARTIAL, never the other way around.
+ *
+ *		If the sphere is G3D_INSIDE the object may be drawn with clipping
+ *	turned off (setClipping(false)); if G3D_OUTSIDE it need not be drawn
+ *	at all. When clipping is turned back on the next draw acts as a
+ *	move, as the last point drawn without clipping is not known.
  */
 
-void G3D::p2init()
+uint8_t G3D::cullSphere(G3DScalar x, G3DScalar y, G3DScalar z, G3DScalar radius)
 {
-	/*
-	 *	We subtract one because we want our mapping to work so that
-	 *	virtual coordinate -1 is in the middle of the 0th pixel, and
-	 *	+1 is in the middle of the width-1 pixel for wide displays.
-	 *
-	 *	This offset of 1/2 by the pixel width implies we're drawing on
-	 *	a display 1 pixel narrower and wider, but then with 1/2 added
-	 *	to the pixel coordinate
-	 */
-	
-	uint16_t h1 = height - 1;
-	uint16_t w1 = width - 1;
-	
-	/*
-	 *	Calculate the width, height in abstract coordinates. This
-	 *	allows me to quickly scale to match our viewport.
-	 */
-	
-	if (w1 > h1) {
-		p2xsize = 1;
-		p2ysize = ((float)h1)/((float)w1);
-	} else {
-		p2xsize = ((float)w1)/((float)h1);
-		p2ysize = 1;
+	G3D_STAGE(4);
+
+	const G3DScalar (*a)[4] = transformation.a;
+	uint8_t ret = G3D_INSIDE;
+
+	for (uint8_t i = 0; i < 6; ++i) {
+		/*
+		 *	Find plane i in model coordinates; these match the walls
+		 *	in OutCode.
+		 */
+
+		G3DScalar p[4];
+		for (uint8_t j = 0; j < 4; ++j) {
+			switch (i) {
+				default:
+				case 0:	p[j] = a[3][j] + a[0][j]; break;	// x >= -w
+				case 1:	p[j] = a[3][j] - a[0][j]; break;	// x <= w
+				case 2:	p[j] = a[3][j] + a[1][j]; break;	// y >= -w
+				case 3:	p[j] = a[3][j] - a[1][j]; break;	// y <= w
+				case 4:	p[j] = a[3][j] + a[2][j]; break;	// z >= -w
+				case 5:	p[j] = - a[2][j]; break;			// z <= 0
+			}
+		}
+
+		/*
+		 *	d is the distance of the center from the plane, scaled by
+		 *	the length of the plane normal n. Compare d to r |n|.
+		 */
+
+		G3DScalar d = p[0] * x + p[1] * y + p[2] * z + p[3];
+		G3DScalar n0 = (p[0] < 0) ? -p[0] : p[0];
+		G3DScalar n1 = (p[1] < 0) ? -p[1] : p[1];
+		G3DScalar n2 = (p[2] < 0) ? -p[2] : p[2];
+		G3DScalar nmax = n0;
+		if (n1 > nmax) nmax = n1;
+		if (n2 > nmax) nmax = n2;
+		G3DScalar rn = radius * (nmax + (n0 + n1 + n2 - nmax) / 2);
+
+		if (d < -rn) return G3D_OUTSIDE;
+		if (d < rn) ret = G3D_PARTIAL;
 	}
-	
-	/*
-	 *	Calculate the scale, offset to transform virtual to real.
-	 *	Note that we scale each axis separately, so our screen is always
-	 *	-1/1. This "squishing" is handled by the perspective and orthographic
-	 *	projection routines above.
-	 */
-	
-	p2xscale = ((float)w1)/2;
-	p2yscale = ((float)h1)/2;
-	p2xoff = ((float)width)/2;
-	p2yoff = ((float)height)/2;
+	return ret;
 }
 
-/*	p2point
+/*	G3D::cullBox
  *
- *		Draw a point at the virtual location on the screen. This
- *	does the appropriate math to scale to our screen coordinates
+ *		Classify an axis aligned bounding box in model coordinates by
+ *	the outcodes of its eight corners. If every corner is outside the
+ *	same wall the box is outside; if every corner is inside the box is
+ *	inside, as our view volume is convex.
  */
 
-void G3D::p2point(float x, float y)
+uint8_t G3D::cullBox(G3DScalar x1, G3DScalar y1, G3DScalar z1, G3DScalar x2, G3DScalar y2, G3DScalar z2)
 {
-	// Flip y coordinate so -1 is at bottom
-	int16_t xpos = (int16_t)(p2xoff + x * p2xscale);
-	int16_t ypos = (int16_t)(p2yoff - y * p2yscale);
-	p1point(xpos,ypos);
-}
+	G3D_STAGE(4);
 
-/*	p2movedraw
- *
- *		Move/draw for virtual coordinates
- */
+	uint8_t andCode = 0x3F;
+	uint8_t orCode = 0;
+	G3DVector t;
 
-void G3D::p2movedraw(bool drawFlag, float x, float y)
-{
-	// Flip y coordinate so -1 is at bottom
-	int16_t xpos = (int16_t)(p2xoff + x * p2xscale);
-	int16_t ypos = (int16_t)(p2yoff - y * p2yscale);
-	p1movedraw(drawFlag,xpos,ypos);
+	for (uint8_t i = 0; i < 8; ++i) {
+		p4transform((i & 1) ? x2 : x1,(i & 2) ? y2 : y1,(i & 4) ? z2 : z1,t);
+		uint8_t code = OutCode(t);
+		andCode &= code;
+		orCode |= code;
+	}
+
+	if (andCode) return G3D_OUTSIDE;
+	if (orCode) return G3D_PARTIAL;
+	return G3D_INSIDE;
 }
 
 /********************************************************************/
 /*                                                                  */
-/*  Move/Draw Level 1												*/
+/*  Mesh Drawing													*/
 /*                                                                  */
 /********************************************************************/
 
-/*	p1init
+/*	G3D::drawMesh
  *
- *		Initialize our pipeline
+ *		Draw an indexed wireframe mesh. Each vertex is transformed and
+ *	outcoded once into the mesh buffer, then each edge is fed to the
+ *	clipper. If the mesh buffer is missing or too small we fall back to
+ *	transforming each edge endpoint as it is drawn.
  */
 
-void G3D::p1init()
+void G3D::drawMesh(const G3DMesh &mesh)
 {
-	p1draw = false;
-	p1x = 0;
-	p1y = 0;
-}
+	G3D_STAGE(4);
 
-/*	p1movedraw
- *
- *		Level 1 talks directly to the hardware. In our case we talk
- *	directly to the Adafruit GFX library. This is the only point where
- *	we do talk to the GFX library. In theory this could be replaced
- *	with code to simply draw lines using Beshingham's algorithm
+	const G3DScalar *vert = mesh.vertices;
+	const uint16_t *edge = mesh.edges;
+	uint16_t last = 0xFFFF;
+	uint16_t i;
+
+	if (mesh.vertexCount > meshBufferSize) {
+		for (i = 0; i < mesh.edgeCount; ++i, edge += 2) {
+			const G3DScalar *a = vert + 3 * edge[0];
+			const G3DScalar *b = vert + 3 * edge[1];
+			if (edge[0] != last) p4movedraw(false,a[0],a[1],a[2]);
+			p4movedraw(true,b[0],b[1],b[2]);
+			last = edge[1];
+		}
+		return;
+	}
+
+	/*
+	 *	Transform all of our vertices
+	 */
+
+	G3DMeshVertex *mv = meshBuffer;
+	for (i = 0; i < mesh.vertexCount; ++i, vert += 3, ++mv) {
+		p4transform(vert[0],vert[1],vert[2],mv->v);
+		mv->outcode = p3clip ? OutCode(mv->v) : 0;
+	}
+
+	drawMeshEdges(mesh,meshBuffer);
+}
+
+/*	FrontFace
+ *
+ *		True if a face, given by three transformed vertices, faces the
+ *	viewer. This is the sign of the determinant of the x, y and w of the
+ *	three vertices, which is their winding on the screen (scaled by the
+ *	three w values) without dividing by w, so it also holds for faces
+ *	which cross the near plane.
  */
 
-void G3D::p1movedraw(bool drawFlag, uint16_t x, uint16_t y)
+static bool FrontFace(const G3DVector &a, const G3DVector &b, const G3DVector &c)
+{
+	G3DScalar det = a.x * (b.y * c.w - b.w * c.y)
+	              - a.y * (b.x * c.w - b.w * c.x)
+	              + a.w * (b.x * c.y - b.y * c.x);
+	return det > 0;
+}
+
+/*	G3D::drawSolidMesh
+ *
+ *		Draw a solid mesh, skipping edges whose faces all face away from
+ *	the viewer. For a convex solid this is the same as hidden line
+ *	removal, and roughly halves the edges drawn. Each face is classified
+ *	once into the face buffer, if it is large enough; otherwise faces
+ *	are classified as each edge is drawn. Without a large enough mesh
+ *	buffer we draw every edge, as drawMesh does.
+ */
+
+void G3D::drawSolidMesh(const G3DSolidMesh &mesh)
+{
+	G3D_STAGE(4);
+
+	uint16_t i;
+
+	if (mesh.vertexCount > meshBufferSize) {
+		G3DMesh wire = { mesh.vertexCount, mesh.edgeCount, mesh.vertices, mesh.edges };
+		drawMesh(wire);
+		return;
+	}
+
+	const G3DScalar *vert = mesh.vertices;
+	G3DMeshVertex *mv = meshBuffer;
+	for (i = 0; i < mesh.vertexCount; ++i, vert += 3, ++mv) {
+		p4transform(vert[0],vert[1],vert[2],mv->v);
+		mv->outcode = p3clip ? OutCode(mv->v) : 0;
+	}
+
+	/*
+	 *	Classify the faces
+	 */
+
+	bool classified = ((uint32_t)faceBufferSize * 8 >= mesh.faceCount);
+	if (classified) {
+		const uint16_t *face = mesh.faces;
+		memset(faceBuffer,0,(mesh.faceCount + 7) >> 3);
+		for (i = 0; i < mesh.faceCount; ++i, face += 3) {
+			if (FrontFace(meshBuffer[face[0]].v,meshBuffer[face[1]].v,meshBuffer[face[2]].v)) {
+				faceBuffer[i >> 3] |= 1 << (i & 7);
+			}
+		}
+	}
+
+	/*
+	 *	Draw the edges on at least one front face
+	 */
+
+	const uint16_t *edge = mesh.edges;
+	const uint16_t *edgeFace = mesh.edgeFaces;
+	uint16_t last = 0xFFFF;
+	for (i = 0; i < mesh.edgeCount; ++i, edge += 2, edgeFace += 2) {
+		bool visible = (edgeFace[0] == G3D_NOFACE) && (edgeFace[1] == G3D_NOFACE);
+		for (uint8_t j = 0; (j < 2) && !visible; ++j) {
+			uint16_t f = edgeFace[j];
+			if (f == G3D_NOFACE) continue;
+			if (classified) {
+				visible = (faceBuffer[f >> 3] >> (f & 7)) & 1;
+			} else {
+				const uint16_t *face = mesh.faces + 3 * f;
+				visible = FrontFace(meshBuffer[face[0]].v,meshBuffer[face[1]].v,meshBuffer[face[2]].v);
+			}
+		}
+		if (!visible) continue;
+
+		const G3DMeshVertex &a = meshBuffer[edge[0]];
+		const G3DMeshVertex &b = meshBuffer[edge[1]];
+		if (a.outcode & b.outcode) {
+			G3D_COUNT(rejected,1);
+			continue;
+		}
+
+		if (p3clip) {
+			if (edge[0] != last) p3movedraw(false,a.v,a.outcode);
+			p3movedraw(true,b.v,b.outcode);
+		} else {
+			if (edge[0] != last) p2movedraw(false,a.v.x/a.v.w,a.v.y/a.v.w);
+			p2movedraw(true,b.v.x/b.v.w,b.v.y/b.v.w);
+		}
+		last = edge[1];
+	}
+}
+
+/*	Length
+ *
+ *		Length of the first three components of a matrix row, in float.
+ *	Level selection runs once per object, so we do it in float even in
+ *	fixed point builds, where the squares could overflow.
+ */
+
+static float Length(const G3DScalar *row)
+{
+	float x = G3DToFloat(row[0]);
+	float y = G3DToFloat(row[1]);
+	float z = G3DToFloat(row[2]);
+	return sqrtf(x * x + y * y + z * z);
+}
+
+/*	G3D::pixelScale
+ *
+ *		The most a model space distance at the nearest point of a
+ *	bounding sphere can move on screen, in pixels per model unit.
+ *
+ *		A model space error e at a point with clip space w moves x/w by
+ *	at most e(|row 0| + |x/w| |row 3|)/w, where row n is row n of our
+ *	transformation, and |x/w| <= 1 for anything we draw; likewise y.
+ *	Multiplying by the stage 2 scale gives pixels. The nearest point of
+ *	the sphere has the smallest w, the w of its center less the radius
+ *	times |row 3|. The sphere's projected radius is its radius times
+ *	this scale. If the sphere reaches the eye nothing can be bounded,
+ *	and we return 0.
+ */
+
+float G3D::pixelScale(G3DScalar x, G3DScalar y, G3DScalar z, G3DScalar radius)
+{
+	const G3DScalar (*a)[4] = transformation.a;
+
+	float w = G3DToFloat(a[3][0] * x + a[3][1] * y + a[3][2] * z + a[3][3]);
+	float n3 = Length(a[3]);
+	w -= G3DToFloat(radius) * n3;
+	if (w <= 0) return 0;
+
+	float sx = G3DToFloat(p2xscale) * (Length(a[0]) + n3);
+	float sy = G3DToFloat(p2yscale) * (Length(a[1]) + n3);
+	return ((sx > sy) ? sx : sy) / w;
+}
+
+/*	G3D::selectLOD
+ *
+ *		Pick the coarsest level of detail whose error, seen from the
+ *	nearest point of the bounding sphere, moves nothing on screen by
+ *	more than the given number of pixels. If the sphere reaches the eye
+ *	we use the full mesh. A mesh with no levels gives G3D_LODSKIPPED.
+ */
+
+uint8_t G3D::selectLOD(const G3DLODMesh &mesh, G3DScalar pixels)
+{
+	if (mesh.levelCount == 0) return G3D_LODSKIPPED;
+
+	float scale = pixelScale(mesh.x,mesh.y,mesh.z,mesh.radius);
+	if (scale <= 0) return 0;
+
+	float limit = G3DToFloat(pixels) / scale;
+	uint8_t level = mesh.levelCount - 1;
+	while ((level > 0) && (G3DToFloat(mesh.levels[level].error) > limit)) --level;
+	return level;
+}
+
+/*	G3D::drawLODMesh
+ *
+ *		Draw a mesh at the coarsest level of detail within the given
+ *	pixel error. The bounding sphere is culled first: a mesh outside the
+ *	view is not drawn, and one inside is drawn without clipping. Returns
+ *	the level drawn, G3D_LODCULLED, or G3D_LODSKIPPED if the mesh has no
+ *	levels.
+ */
+
+uint8_t G3D::drawLODMesh(const G3DLODMesh &mesh, G3DScalar pixels)
+{
+	G3D_STAGE(4);
+
+	uint8_t cull = cullSphere(mesh.x,mesh.y,mesh.z,mesh.radius);
+	if (cull == G3D_OUTSIDE) return G3D_LODCULLED;
+
+	uint8_t level = selectLOD(mesh,pixels);
+	if (level != G3D_LODSKIPPED) drawLODLevel(mesh,level,cull);
+	return level;
+}
+
+/*	G3D::drawLODLevel
+ *
+ *		Draw one level of a mesh, given the result of culling its
+ *	bounding sphere; one inside the view is drawn without clipping. A
+ *	level the mesh does not have draws nothing.
+ */
+
+void G3D::drawLODLevel(const G3DLODMesh &mesh, uint8_t level, uint8_t cull)
+{
+	G3D_STAGE(4);
+
+	if (level >= mesh.levelCount) return;
+	const G3DLODLevel &l = mesh.levels[level];
+	G3DMesh m = { l.vertexCount, l.edgeCount, mesh.vertices, l.edges };
+
+	bool clip = p3clip;
+	if (cull == G3D_INSIDE) setClipping(false);
+	drawMesh(m);
+	setClipping(clip);
+}
+
+/*	G3D::drawInstances
+ *
+ *		Draw count copies of a mesh, each moved by an x,y,z triplet from
+ *	offsets. Because the transformation is linear, a vertex of an
+ *	instance transforms to the transformed base vertex plus the offset
+ *	transformed as a direction (w = 0). So we transform the base mesh
+ *	once into the first half of the mesh buffer, and each instance only
+ *	costs a four component add and an outcode per vertex.
+ *
+ *		This needs a mesh buffer of twice the vertex count; otherwise we
+ *	draw each instance with drawMesh.
+ */
+
+void G3D::drawInstances(const G3DMesh &mesh, uint16_t count, const G3DScalar *offsets)
+{
+	G3D_STAGE(4);
+
+	uint16_t i;
+
+	if ((uint32_t)mesh.vertexCount * 2 > meshBufferSize) {
+		G3DMatrix save = transformation;
+		for (i = 0; i < count; ++i, offsets += 3) {
+			transformation = save;
+			transformation.translate(offsets[0],offsets[1],offsets[2]);
+			drawMesh(mesh);
+		}
+		transformation = save;
+		return;
+	}
+
+	/*
+	 *	Transform the base mesh
+	 */
+
+	G3DMeshVertex *base = meshBuffer;
+	G3DMeshVertex *inst = meshBuffer + mesh.vertexCount;
+	const G3DScalar *vert = mesh.vertices;
+	for (i = 0; i < mesh.vertexCount; ++i, vert += 3) {
+		p4transform(vert[0],vert[1],vert[2],base[i].v);
+	}
+
+	/*
+	 *	Offset the base mesh for each instance and draw it
+	 */
+
+	const G3DScalar (*a)[4] = transformation.a;
+	for (uint16_t n = 0; n < count; ++n, offsets += 3) {
+		G3DScalar ox = offsets[0];
+		G3DScalar oy = offsets[1];
+		G3DScalar oz = offsets[2];
+		G3DScalar dx = a[0][0] * ox + a[0][1] * oy + a[0][2] * oz;
+		G3DScalar dy = a[1][0] * ox + a[1][1] * oy + a[1][2] * oz;
+		G3DScalar dz = a[2][0] * ox + a[2][1] * oy + a[2][2] * oz;
+		G3DScalar dw = a[3][0] * ox + a[3][1] * oy + a[3][2] * oz;
+
+		for (i = 0; i < mesh.vertexCount; ++i) {
+			G3DVector &v = inst[i].v;
+			v.x = base[i].v.x + dx;
+			v.y = base[i].v.y + dy;
+			v.z = base[i].v.z + dz;
+			v.w = base[i].v.w + dw;
+			inst[i].outcode = p3clip ? OutCode(v) : 0;
+		}
+
+		drawMeshEdges(mesh,inst);
+	}
+}
+
+/*	G3D::drawMeshEdges
+ *
+ *		Draw the edges of a mesh whose vertices have been transformed
+ *	into v. Edges entirely outside a single clipping wall are rejected
+ *	without touching the clipper; edges which continue from the last
+ *	point drawn skip the move.
+ */
+
+void G3D::drawMeshEdges(const G3DMesh &mesh, const G3DMeshVertex *v)
+{
+	const uint16_t *edge = mesh.edges;
+	uint16_t last = 0xFFFF;
+
+	for (uint16_t i = 0; i < mesh.edgeCount; ++i, edge += 2) {
+		const G3DMeshVertex &a = v[edge[0]];
+		const G3DMeshVertex &b = v[edge[1]];
+		if (a.outcode & b.outcode) {
+			G3D_COUNT(rejected,1);
+			continue;
+		}
+
+		if (p3clip) {
+			if (edge[0] != last) p3movedraw(false,a.v,a.outcode);
+			p3movedraw(true,b.v,b.outcode);
+		} else {
+			if (edge[0] != last) p2movedraw(false,a.v.x/a.v.w,a.v.y/a.v.w);
+			p2movedraw(true,b.v.x/b.v.w,b.v.y/b.v.w);
+		}
+		last = edge[1];
+	}
+}
+
+/*	CompactByte, CompactWord
+ *
+ *		Read from a compact mesh held in RAM or in flash. Words are read
+ *	a byte at a time as they are little endian and may be unaligned.
+ */
+
+static inline uint8_t CompactByte(const uint8_t *p, bool flash)
+{
+	return flash ? pgm_read_byte(p) : *p;
+}
+
+static inline uint16_t CompactWord(const uint8_t *p, bool flash)
+{
+	return CompactByte(p,flash) | ((uint16_t)CompactByte(p+1,flash) << 8);
+}
+
+/*	CompactVertex
+ *
+ *		Read the quantized coordinates of a vertex and scale them. The
+ *	scale is applied in float: the scale of an int16 mesh is too small
+ *	to hold accurately in fixed point.
+ */
+
+static inline void CompactVertex(const uint8_t *p, uint8_t vsize, float scale, bool flash, G3DScalar c[3])
+{
+	for (uint8_t j = 0; j < 3; ++j, p += vsize) {
+		if (vsize == 2) {
+			c[j] = G3DScalar((int16_t)CompactWord(p,flash) * scale);
+		} else {
+			c[j] = G3DScalar((int8_t)CompactByte(p,flash) * scale);
+		}
+	}
+}
+
+/*	G3D::drawCompact
+ *
+ *		Draw a compact mesh (see G3DMesh.h). If the mesh buffer is large
+ *	enough each vertex is transformed once and strips are drawn as in
+ *	drawMesh; otherwise each strip vertex is transformed as it is drawn.
+ *	Returns false, drawing nothing, if the data is not a compact mesh,
+ *	a strip runs past the end of the length bytes given, or a strip
+ *	refers to a vertex the mesh does not have.
+ */
+
+bool G3D::drawCompact(const uint8_t *data, uint32_t length, bool flash)
 {
+	G3D_STAGE(4);
+
+	if ((length < G3D_COMPACT_HEADER) ||
+			(CompactByte(data,flash) != 'G') ||
+			(CompactByte(data+1,flash) != '3') ||
+			(CompactByte(data+2,flash) != 'M') ||
+			(CompactByte(data+3,flash) != G3D_COMPACT_VERSION)) {
+		return false;
+	}
+
+	uint8_t flags = CompactByte(data+4,flash);
+	uint16_t vertexCount = CompactWord(data+6,flash);
+	uint16_t stripCount = CompactWord(data+8,flash);
+	uint8_t vsize = (flags & G3D_COMPACT_WORD) ? 2 : 1;
+	uint8_t isize = (flags & G3D_COMPACT_WIDEINDEX) ? 2 : 1;
+
+	float scale;
+	uint8_t raw[4];
+	for (uint8_t i = 0; i < 4; ++i) raw[i] = CompactByte(data+12+i,flash);
+	memcpy(&scale,raw,4);
+
+	const uint8_t *vert = data + G3D_COMPACT_HEADER;
+	uint32_t used = G3D_COMPACT_HEADER + 3 * vsize * (uint32_t)vertexCount;
+	if (used > length) return false;
+	const uint8_t *strip = data + used;
+
+	/*
+	 *	Walk the strips once before drawing anything, so a truncated or
+	 *	corrupt mesh is never read past its end
+	 */
+
+	for (uint16_t s = 0; s < stripCount; ++s) {
+		if (used + 2 > length) return false;
+		uint16_t count = CompactWord(data + used,flash);
+		used += 2;
+		if (used + isize * (uint32_t)count > length) return false;
+		for (uint16_t k = 0; k < count; ++k, used += isize) {
+			uint16_t index = (isize == 2) ? CompactWord(data + used,flash) : CompactByte(data + used,flash);
+			if (index >= vertexCount) return false;
+		}
+	}
+
 	/*
-	 *	We use the p1drawflag and the drawFlag objects to determine the
-	 *	way to draw our line. For us, we're always drawing single
-	 *	segments, but we theoretically could roll up our lines into a
-	 *	collection of line segments and send them on close. (This
-	 *	requires hooking G3D::end().)
+	 *	Transform all of our vertices, if we have room
+	 */
+
+	bool buffered = (vertexCount <= meshBufferSize);
+	if (buffered) {
+		const uint8_t *p = vert;
+		G3DMeshVertex *mv = meshBuffer;
+		for (uint16_t i = 0; i < vertexCount; ++i, ++mv, p += 3 * vsize) {
+			G3DScalar c[3];
+			CompactVertex(p,vsize,scale,flash,c);
+			p4transform(c[0],c[1],c[2],mv->v);
+			mv->outcode = p3clip ? OutCode(mv->v) : 0;
+		}
+	}
+
+	/*
+	 *	Draw the strips. As with drawMesh we reject segments entirely
+	 *	outside one clipping wall, lifting the pen.
+	 */
+
+	for (uint16_t s = 0; s < stripCount; ++s) {
+		uint16_t count = CompactWord(strip,flash);
+		strip += 2;
+
+		bool pen = false;
+		uint16_t prev = 0;
+		for (uint16_t k = 0; k < count; ++k, strip += isize) {
+			uint16_t index = (isize == 2) ? CompactWord(strip,flash) : CompactByte(strip,flash);
+
+			if (!buffered) {
+				G3DScalar c[3];
+				CompactVertex(vert + 3 * vsize * (uint32_t)index,vsize,scale,flash,c);
+				if (count == 1) {
+					p4point(c[0],c[1],c[2]);
+				} else {
+					p4movedraw(k > 0,c[0],c[1],c[2]);
+				}
+				continue;
+			}
+
+			const G3DMeshVertex &b = meshBuffer[index];
+			if (count == 1) {
+				p3point(b.v);
+			} else if (k > 0) {
+				const G3DMeshVertex &a = meshBuffer[prev];
+				if (a.outcode & b.outcode) {
+					G3D_COUNT(rejected,1);
+					pen = false;
+				} else {
+					if (!pen) {
+						if (p3clip) {
+							p3movedraw(false,a.v,a.outcode);
+						} else {
+							p2movedraw(false,a.v.x/a.v.w,a.v.y/a.v.w);
+						}
+					}
+					if (p3clip) {
+						p3movedraw(true,b.v,b.outcode);
+					} else {
+						p2movedraw(true,b.v.x/b.v.w,b.v.y/b.v.w);
+					}
+					pen = true;
+				}
+			}
+			prev = index;
+		}
+	}
+
+	return true;
+}
+
+/*	G3D::drawBatch
+ *
+ *		Draw edges between vertices which were transformed with
+ *	transformBatch. Like drawMesh this rejects edges outside a common
+ *	clip wall and skips the move for edges which continue the last one.
+ */
+
+void G3D::drawBatch(const G3DBatch &batch, uint32_t edgeCount, const uint32_t *edges)
+{
+	G3D_STAGE(4);
+
+	uint32_t last = 0xFFFFFFFF;
+	G3DVector v;
+
+	for (uint32_t i = 0; i < edgeCount; ++i, edges += 2) {
+		uint32_t a = edges[0];
+		uint32_t b = edges[1];
+		if (batch.outcode[a] & batch.outcode[b]) {
+			G3D_COUNT(rejected,1);
+			continue;
+		}
+
+		if (a != last) {
+			v.x = batch.x[a];
+			v.y = batch.y[a];
+			v.z = batch.z[a];
+			v.w = batch.w[a];
+			if (p3clip) {
+				p3movedraw(false,v,batch.outcode[a]);
+			} else {
+				p2movedraw(false,v.x/v.w,v.y/v.w);
+			}
+		}
+		v.x = batch.x[b];
+		v.y = batch.y[b];
+		v.z = batch.z[b];
+		v.w = batch.w[b];
+		if (p3clip) {
+			p3movedraw(true,v,batch.outcode[b]);
+		} else {
+			p2movedraw(true,v.x/v.w,v.y/v.w);
+		}
+		last = b;
+	}
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Display Lists													*/
+/*                                                                  */
+/********************************************************************/
+
+/*	G3D::drawList
+ *
+ *		Replay a display list held in RAM through the pipeline using
+ *	the current transformation. Opcodes are read a byte, four commands,
+ *	at a time.
+ */
+
+void G3D::drawList(const uint8_t *ops, const G3DScalar *v)
+{
+	for (;; ++ops) {
+		uint8_t bits = *ops;
+		for (uint8_t i = 0; i < 4; ++i, bits >>= 2, v += 3) {
+			switch (bits & 3) {
+				case G3D_LIST_MOVE:
+					p4movedraw(false,v[0],v[1],v[2]);
+					break;
+				case G3D_LIST_DRAW:
+					p4movedraw(true,v[0],v[1],v[2]);
+					break;
+				case G3D_LIST_POINT:
+					p4point(v[0],v[1],v[2]);
+					break;
+				default:
+					return;
+			}
+		}
+	}
+}
+
+/*	G3D::drawList_P
+ *
+ *		Replay a display list stored in flash (PROGMEM). Each vertex is
+ *	copied out of program memory before it is used.
+ */
+
+void G3D::drawList_P(const uint8_t *ops, const G3DScalar *v)
+{
+	G3DScalar e[3];
+
+	for (;; ++ops) {
+		uint8_t bits = pgm_read_byte(ops);
+		for (uint8_t i = 0; i < 4; ++i, bits >>= 2, v += 3) {
+			uint8_t op = bits & 3;
+			if (op == G3D_LIST_END) return;
+			memcpy_P(e,v,sizeof(e));
+			if (op == G3D_LIST_POINT) {
+				p4point(e[0],e[1],e[2]);
+			} else {
+				p4movedraw(op == G3D_LIST_DRAW,e[0],e[1],e[2]);
+			}
+		}
+	}
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Move/Draw Level 2												*/
+/*                                                                  */
+/********************************************************************/
+
+/*	G3D::p2init
+ *
+ *		Initialize p2 framework
+ */
+
+void G3D::p2init()
+{
+	/*
+	 *	We subtract one because we want our mapping to work so that
+	 *	virtual coordinate -1 is in the middle of the 0th pixel, and
+	 *	+1 is in the middle of the width-1 pixel for wide displays.
+	 *
+	 *	This offset of 1/2 by the pixel width implies we're drawing on
+	 *	a display 1 pixel narrower and wider, but then with 1/2 added
+	 *	to the pixel coordinate
 	 */
 	
-	if (drawFlag) {
+	uint16_t h1 = height - 1;
+	uint16_t w1 = width - 1;
+	
+	/*
+	 *	Calculate the width, height in abstract coordinates. This
+	 *	allows me to quickly scale to match our viewport.
+	 */
+	
+	if (w1 > h1) {
+		p2xsize = 1;
+		p2ysize = ((G3DScalar)h1)/((G3DScalar)w1);
+	} else {
+		p2xsize = ((G3DScalar)w1)/((G3DScalar)h1);
+		p2ysize = 1;
+	}
+	
+	/*
+	 *	Calculate the scale, offset to transform virtual to real.
+	 *	Note that we scale each axis separately, so our screen is always
+	 *	-1/1. This "squishing" is handled by the perspective and orthographic
+	 *	projection routines above.
+	 */
+	
+	p2xscale = ((G3DScalar)w1)/2;
+	p2yscale = ((G3DScalar)h1)/2;
+	p2xoff = ((G3DScalar)width)/2;
+	p2yoff = ((G3DScalar)height)/2;
+}
+
+/*	p2point
+ *
+ *		Draw a point at the virtual location on the screen. This
+ *	does the appropriate math to scale to our screen coordinates
+ */
+
+void G3D::p2point(G3DScalar x, G3DScalar y)
+{
+	G3D_STAGE(2);
+
+	// Flip y coordinate so -1 is at bottom
+	int16_t xpos = G3DToInt(p2xoff + x * p2xscale);
+	int16_t ypos = G3DToInt(p2yoff - y * p2yscale);
+	p1point(xpos,ypos);
+}
+
+#if G3D_GUARDBAND > 0
+
+/*	p2clipdraw
+ *
+ *		Draw a line from (x0,y0) to (x1,y1) in virtual coordinates,
+ *	clipping it to the viewport with Cohen-Sutherland in screen space.
+ *	Screen coordinates are kept as scalars, with their fractions, until
+ *	the line is clipped, so off screen endpoints are not rounded before
+ *	the intersections are found; each intersection divides first, so
+ *	fixed point cannot overflow. The line is clipped to the centers of
+ *	the edge pixels, which are then the pixels drawn. If moveFlag is set
+ *	the pen is not at the start of the line, so we move to the
+ *	(clipped) start first.
+ */
+
+#define P2LEFT		1
+#define P2RIGHT		2
+#define P2TOP		4
+#define P2BOTTOM	8
+
+static inline uint8_t P2Code(G3DScalar x, G3DScalar y, G3DScalar xmin, G3DScalar ymin, G3DScalar xmax, G3DScalar ymax)
+{
+	uint8_t m = 0;
+
+	if (x < xmin) m |= P2LEFT;
+	if (x > xmax) m |= P2RIGHT;
+	if (y < ymin) m |= P2TOP;
+	if (y > ymax) m |= P2BOTTOM;
+
+	return m;
+}
+
+/*	P2Pixel
+ *
+ *		The pixel holding a clipped screen coordinate. Rounding in fixed
+ *	point can leave it a hair outside the edge pixel's center, so pin it
+ *	into the viewport.
+ */
+
+static inline int16_t P2Pixel(G3DScalar v, int16_t max)
+{
+	int16_t p = G3DToInt(v);
+	if (p < 0) return 0;
+	if (p > max) return max;
+	return p;
+}
+
+void G3D::p2clipdraw(bool moveFlag, G3DScalar x0, G3DScalar y0, G3DScalar x1, G3DScalar y1)
+{
+	G3D_STAGE(2);
+
+	G3DScalar xa = p2xoff + x0 * p2xscale;
+	G3DScalar ya = p2yoff - y0 * p2yscale;
+	G3DScalar xb = p2xoff + x1 * p2xscale;
+	G3DScalar yb = p2yoff - y1 * p2yscale;
+	G3DScalar half = 0.5f;
+	G3DScalar xmax = G3DScalar(width) - half;
+	G3DScalar ymax = G3DScalar(height) - half;
+
+	uint8_t ca = P2Code(xa,ya,half,half,xmax,ymax);
+	uint8_t cb = P2Code(xb,yb,half,half,xmax,ymax);
+
+	/*
+	 *	Move whichever end is outside to the edge it is beyond, until
+	 *	the line is inside or entirely beyond one edge. Each end crosses
+	 *	at most two edges, so four steps are enough; anything left over
+	 *	is rounding, which P2Pixel pins.
+	 */
+
+	for (uint8_t i = 0; (ca | cb) && (i < 4); ++i) {
+		if (ca & cb) return;
+
+		uint8_t c = ca ? ca : cb;
+		G3DScalar x, y;
+
+		if (c & P2LEFT) {
+			x = half;
+			y = ya + (yb - ya) * ((x - xa) / (xb - xa));
+		} else if (c & P2RIGHT) {
+			x = xmax;
+			y = ya + (yb - ya) * ((x - xa) / (xb - xa));
+		} else if (c & P2TOP) {
+			y = half;
+			x = xa + (xb - xa) * ((y - ya) / (yb - ya));
+		} else {
+			y = ymax;
+			x = xa + (xb - xa) * ((y - ya) / (yb - ya));
+		}
+
+		if (c == ca) {
+			xa = x;
+			ya = y;
+			ca = P2Code(xa,ya,half,half,xmax,ymax);
+			moveFlag = true;
+		} else {
+			xb = x;
+			yb = y;
+			cb = P2Code(xb,yb,half,half,xmax,ymax);
+		}
+	}
+	if (ca & cb) return;
+
+	if (moveFlag) p1movedraw(false,P2Pixel(xa,width - 1),P2Pixel(ya,height - 1));
+	p1movedraw(true,P2Pixel(xb,width - 1),P2Pixel(yb,height - 1));
+}
+
+#endif
+
+/*	p2movedraw
+ *
+ *		Move/draw for virtual coordinates
+ */
+
+void G3D::p2movedraw(bool drawFlag, G3DScalar x, G3DScalar y)
+{
+	G3D_STAGE(2);
+
+	// Flip y coordinate so -1 is at bottom
+	int16_t xpos = G3DToInt(p2xoff + x * p2xscale);
+	int16_t ypos = G3DToInt(p2yoff - y * p2yscale);
+
+#if G3D_PACKED
+	/*
+	 *	Rounding in the clipper (mostly with G3D_FIXED8) can land an
+	 *	endpoint a pixel outside the viewport. Stage 1 writes straight
+	 *	into the display buffer, so pin it inside.
+	 */
+
+	if (xpos < 0) xpos = 0;
+	if (xpos >= (int16_t)width) xpos = width - 1;
+	if (ypos < 0) ypos = 0;
+	if (ypos >= (int16_t)height) ypos = height - 1;
+#endif
+
+	p1movedraw(drawFlag,xpos,ypos);
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Move/Draw Level 1												*/
+/*                                                                  */
+/********************************************************************/
+
+/*	p1init
+ *
+ *		Initialize our pipeline
+ */
+
+void G3D::p1init()
+{
+	p1draw = false;
+	p1x = 0;
+	p1y = 0;
+
+#if G3D_PACKED && (USELIBRARY == 2)
+	p1buffer = lib.getBuffer();
+	p1stride = WIDTH;
+#elif G3D_PACKED && (USELIBRARY == 3)
+	p1buffer = (lib.format() == G3D_FORMAT_MONO) ? lib.getBuffer() : NULL;
+	p1stride = lib.width();
+#endif
+
+#if G3D_POLYLINE > 1
+	p1count = 0;
+	p1cont = false;
+#endif
+}
+
+#if G3D_STATS > 0
+
+/*	LinePixels
+ *
+ *		The number of pixels in a line, for the statistics
+ */
+
+static inline uint16_t LinePixels(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1)
+{
+	uint16_t dx = (x0 < x1) ? x1 - x0 : x0 - x1;
+	uint16_t dy = (y0 < y1) ? y1 - y0 : y0 - y1;
+	return ((dx > dy) ? dx : dy) + 1;
+}
+
+#endif
+
+/*	p1segment
+ *
+ *		Draw one segment. The packed writer skips the first pixel if
+ *	skipFirst is set, because it is the last pixel of the previous
+ *	segment of a polyline; the display library's own line primitive
+ *	(Adafruit_GFX's writeLine, which draws horizontal and vertical lines
+ *	with fast fills) plots it again.
+ */
+
+void G3D::p1segment(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, bool skipFirst)
+{
+#if G3D_PACKED
+	if (p1buffer) {
+		G3D_COUNT(pixels,LinePixels(x0,y0,x1,y1) - (skipFirst ? 1 : 0));
+		p1packed(x0,y0,x1,y1,skipFirst);
+		return;
+	}
+#else
+	(void)skipFirst;
+#endif
+
+	G3D_COUNT(pixels,LinePixels(x0,y0,x1,y1));
 #if USELIBRARY == 1
-		lib.writeLine(xoffset + p1x,yoffset + p1y,xoffset + x,yoffset + y,color);
-#elif USELIBRARY == 2
-		lib.drawLine(xoffset + p1x,yoffset + p1y,xoffset + x,yoffset + y,color);
+	lib.writeLine(xoffset + x0,yoffset + y0,xoffset + x1,yoffset + y1,color);
+#else
+	lib.drawLine(xoffset + x0,yoffset + y0,xoffset + x1,yoffset + y1,color);
 #endif
+}
+
+#if G3D_PACKED
+
+/*	p1packed
+ *
+ *		Draw a line directly into a page packed 1-bit buffer. This walks
+ *	the same pixels as p1segment, but tracks the byte and bit for the
+ *	current pixel as it goes and gathers the bits which fall in the same
+ *	byte, so a steep line writes each byte once for up to 8 pixels. The
+ *	endpoints are inside the viewport, so nothing is bounds checked.
+ */
+
+void G3D::p1packed(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, bool skipFirst)
+{
+	x0 += xoffset;
+	y0 += yoffset;
+	x1 += xoffset;
+	y1 += yoffset;
+
+	int16_t dx = (int16_t)x1 - (int16_t)x0;
+	int16_t dy = (int16_t)y1 - (int16_t)y0;
+	int16_t sx = 1;
+	int16_t sy = 1;
+
+	if (dx < 0) {
+		dx = -dx;
+		sx = -1;
+	}
+	if (dy < 0) {
+		dy = -dy;
+		sy = -1;
 	}
+
+	uint8_t *ptr = p1buffer + (y0 >> 3) * p1stride + x0;
+	uint8_t bit = 1 << (y0 & 7);
+	uint8_t bits = skipFirst ? 0 : bit;
+	bool set = (color != 0);
+
+	/*
+	 *	Each time we step to a new byte, write the bits gathered for
+	 *	the old one
+	 */
+
+	int16_t err = dx - dy;
+	for (int16_t n = (dx > dy) ? dx : dy; n > 0; --n) {
+		int16_t e2 = err * 2;
+		if (e2 > -dy) {
+			err -= dy;
+			if (set) *ptr |= bits; else *ptr &= ~bits;
+			bits = 0;
+			ptr += sx;
+		}
+		if (e2 < dx) {
+			err += dx;
+			if (sy > 0) {
+				bit <<= 1;
+				if (bit == 0) {
+					if (set) *ptr |= bits; else *ptr &= ~bits;
+					bits = 0;
+					bit = 0x01;
+					ptr += p1stride;
+				}
+			} else {
+				bit >>= 1;
+				if (bit == 0) {
+					if (set) *ptr |= bits; else *ptr &= ~bits;
+					bits = 0;
+					bit = 0x80;
+					ptr -= p1stride;
+				}
+			}
+		}
+		bits |= bit;
+	}
+	if (set) *ptr |= bits; else *ptr &= ~bits;
+
+#if USELIBRARY == 3
+	lib.markLine(x0,y0,x1,y1);
+#endif
+}
+
+#endif
+
+#if G3D_BANDS > 0
+
+/*	p1bin
+ *
+ *		Record a segment in the list for the band holding its top end
+ */
+
+void G3D::p1bin(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2)
+{
+	if (bandCount >= bandSize) {
+		bandDropped = true;
+		return;
+	}
+
+	G3D_COUNT(pixels,LinePixels(x1,y1,x2,y2));
+
+	uint16_t i = bandCount++;
+	G3DBandSegment &seg = bandBuffer[i];
+	seg.x1 = x1;
+	seg.y1 = y1;
+	seg.x2 = x2;
+	seg.y2 = y2;
+	seg.color = color;
+	seg.next = G3D_NOSEGMENT;
+
+	uint8_t band = ((y1 < y2) ? y1 : y2) / bandRows;
+	if (band >= G3D_BANDS) band = G3D_BANDS - 1;
+	if (bandHead[band] == G3D_NOSEGMENT) {
+		bandHead[band] = i;
+	} else {
+		bandBuffer[bandTail[band]].next = i;
+	}
+	bandTail[band] = i;
+}
+
+/*	p1band
+ *
+ *		Draw the part of a recorded segment between rows top and bottom
+ *	(exclusive), offset so top is row 0 of the display buffer. We walk
+ *	the line from its start with the same Bresenham steps as p1segment,
+ *	so every band gets exactly the pixels of the whole line, plotting
+ *	only those inside the band and stopping once we leave it.
+ */
+
+void G3D::p1band(const G3DBandSegment &seg, uint16_t top, uint16_t bottom)
+{
+	int16_t x0 = seg.x1;
+	int16_t y0 = seg.y1;
+	int16_t x1 = seg.x2;
+	int16_t y1 = seg.y2;
+	int16_t dx = x1 - x0;
+	int16_t dy = y1 - y0;
+	int16_t sx = 1;
+	int16_t sy = 1;
+
+	if (dx < 0) {
+		dx = -dx;
+		sx = -1;
+	}
+	if (dy < 0) {
+		dy = -dy;
+		sy = -1;
+	}
+
+	int16_t err = dx - dy;
+	for (;;) {
+		if ((y0 >= (int16_t)top) && (y0 < (int16_t)bottom)) {
+			uint16_t y = y0 - top;
+#if G3D_PACKED
+			if (p1buffer) {
+				uint8_t *ptr = p1buffer + (y >> 3) * p1stride + xoffset + x0;
+				if (seg.color) {
+					*ptr |= 1 << (y & 7);
+				} else {
+					*ptr &= ~(1 << (y & 7));
+				}
+			} else
+#endif
+			{
+#if USELIBRARY == 1
+				lib.writePixel(xoffset + x0,y,seg.color);
+#else
+				lib.drawPixel(xoffset + x0,y,seg.color);
+#endif
+			}
+		} else if ((sy > 0) ? (y0 >= (int16_t)bottom) : (y0 < (int16_t)top)) {
+			break;
+		}
+		if ((x0 == x1) && (y0 == y1)) break;
+
+		int16_t e2 = err * 2;
+		if (e2 > -dy) {
+			err -= dy;
+			x0 += sx;
+		}
+		if (e2 < dx) {
+			err += dx;
+			y0 += sy;
+		}
+	}
+}
+
+#endif
+
+/*	p1flush
+ *
+ *		Draw the pending polyline, if any. With the packed writer each
+ *	shared vertex is plotted only once.
+ */
+
+void G3D::p1flush()
+{
+	G3D_STAGE(1);
+
+#if G3D_POLYLINE > 1
+	for (uint8_t i = 1; i < p1count; ++i) {
+		p1segment(p1line[i-1].x,p1line[i-1].y,p1line[i].x,p1line[i].y,p1cont || (i > 1));
+	}
+	p1count = 0;
+	p1cont = false;
+#endif
+}
+
+/*	p1damage
+ *
+ *		Record a segment for erase
+ */
+
+void G3D::p1damage(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2)
+{
+	if (x1 < damageLeft) damageLeft = x1;
+	if (x2 < damageLeft) damageLeft = x2;
+	if (x1 > damageRight) damageRight = x1;
+	if (x2 > damageRight) damageRight = x2;
+	if (y1 < damageTop) damageTop = y1;
+	if (y2 < damageTop) damageTop = y2;
+	if (y1 > damageBottom) damageBottom = y1;
+	if (y2 > damageBottom) damageBottom = y2;
+
+	if (damageCount < damageSize) {
+		G3DSegment &seg = damage[damageCount++];
+		seg.x1 = x1;
+		seg.y1 = y1;
+		seg.x2 = x2;
+		seg.y2 = y2;
+	} else {
+		damageOverflow = true;
+	}
+}
+
+/*	p1fillrect
+ *
+ *		Fill a rectangle in the current color
+ */
+
+void G3D::p1fillrect(uint16_t x, uint16_t y, uint16_t w, uint16_t h)
+{
+	G3D_STAGE(1);
+	G3D_COUNT(pixels,(uint32_t)w * h);
+
+#if USELIBRARY == 1
+	lib.writeFillRect(xoffset + x,yoffset + y,w,h,color);
+#elif (USELIBRARY == 2) || (USELIBRARY == 3)
+	lib.fillRect(xoffset + x,yoffset + y,w,h,color);
+#endif
+}
+
+/*	p1movedraw
+ *
+ *		Level 1 talks directly to the hardware. In our case we talk
+ *	directly to the Adafruit GFX library. This is the only point where
+ *	we do talk to the GFX library.
+ */
+
+void G3D::p1movedraw(bool drawFlag, uint16_t x, uint16_t y)
+{
+	G3D_STAGE(1);
+
+	if (drawFlag) G3D_COUNT(lines,1);
+
+#if G3D_PARALLEL
+	/*
+	 *	A G3DParallel worker records the segment for G3DParallel to draw
+	 */
+
+	if (p1capture) {
+		if (drawFlag) {
+			G3DSegment &seg = p1capture[p1captureCount++];
+			seg.x1 = p1x;
+			seg.y1 = p1y;
+			seg.x2 = x;
+			seg.y2 = y;
+		}
+		p1draw = drawFlag;
+		p1x = x;
+		p1y = y;
+		return;
+	}
+#endif
+
+#if G3D_BANDS > 0
+	/*
+	 *	When drawing in bands, record the segment for later
+	 */
+
+	if (bandBuffer) {
+		if (drawFlag) {
+			p1bin(p1x,p1y,x,y);
+			if (damage) p1damage(p1x,p1y,x,y);
+		}
+		p1draw = drawFlag;
+		p1x = x;
+		p1y = y;
+		return;
+	}
+#endif
+
+#if G3D_POLYLINE > 1
+	/*
+	 *	Roll connected segments up into a polyline, which we draw
+	 *	ourselves when the pen is lifted or the buffer fills. When the
+	 *	buffer fills we continue from its last point, which has already
+	 *	been plotted.
+	 */
+
+	if (drawFlag) {
+		if (p1count == 0) {
+			p1line[0].x = p1x;
+			p1line[0].y = p1y;
+			p1count = 1;
+		}
+		p1line[p1count].x = x;
+		p1line[p1count].y = y;
+		if (++p1count >= G3D_POLYLINE) {
+			p1flush();
+			p1line[0].x = x;
+			p1line[0].y = y;
+			p1count = 1;
+			p1cont = true;
+		}
+	} else {
+		p1flush();
+	}
+#else
+	/*
+	 *	Hand each segment to the display library as it arrives.
+	 */
+	
+	if (drawFlag) p1segment(p1x,p1y,x,y,false);
+#endif
+
+	if (drawFlag && damage) p1damage(p1x,p1y,x,y);
 	
 	p1draw = drawFlag;
 	p1x = x;
@@ -479,9 +2099,33 @@ void G3D::p1movedraw(bool drawFlag, uint16_t x, uint16_t y)
 
 void G3D::p1point(uint16_t x, uint16_t y)
 {
+	G3D_STAGE(1);
+
+	G3D_COUNT(points,1);
+
+#if G3D_PARALLEL
+	if (p1capture) {
+		G3DSegment &seg = p1capture[p1captureCount++];
+		seg.x1 = seg.x2 = x;
+		seg.y1 = seg.y2 = y;
+		return;
+	}
+#endif
+
+	if (damage) p1damage(x,y,x,y);
+
+#if G3D_BANDS > 0
+	if (bandBuffer) {
+		p1bin(x,y,x,y);
+		return;
+	}
+#endif
+
+	G3D_COUNT(pixels,1);
+
 #if USELIBRARY == 1
 	lib.writePixel(xoffset + x,yoffset + y,color);
-#elif USELIBRARY == 2
+#elif (USELIBRARY == 2) || (USELIBRARY == 3)
 	lib.drawPixel(xoffset + x,yoffset + y,color);
 #endif
 }
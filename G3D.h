@@ -12,15 +12,212 @@
 /*                                                                  */
 /********************************************************************/
 
-#define USELIBRARY			2	// 1 = Adafruit, 2 = Arduboy
+#ifndef USELIBRARY
+#define USELIBRARY			2	// 1 = Adafruit, 2 = Arduboy, 3 = G3DFrameBuffer
+#endif
+
+/*
+ *	Depth of the transformation matrix stack used by G3D::push and
+ *	G3D::pop. Each entry costs sizeof(G3DMatrix) bytes of RAM (64 bytes
+ *	with float) in every G3D, so the stack is off by default and push
+ *	and pop return false; set this to the depth needed to use them.
+ */
+
+#ifndef G3D_STACKDEPTH
+#define G3D_STACKDEPTH		0
+#endif
+
+/*
+ *	With G3D_PACKED set, stage 1 draws lines straight into a 1-bit page
+ *	packed display buffer (the Arduboy layout) rather than through the
+ *	display library. Stage 3 keeps every endpoint inside the viewport,
+ *	so no bounds checks are needed.
+ */
+
+#ifndef G3D_PACKED
+#if (USELIBRARY == 2) || (USELIBRARY == 3)
+#define G3D_PACKED			1
+#else
+#define G3D_PACKED			0
+#endif
+#endif
+
+/*
+ *	Stage 1 collects connected line segments into a polyline of up to
+ *	G3D_POLYLINE points, which is drawn when the pen is lifted, the color
+ *	changes, the buffer fills, or at G3D::end(). This only pays with the
+ *	packed writer, which plots each shared vertex once, so it is on by
+ *	default only with G3D_PACKED; display libraries are handed each
+ *	segment through their own line primitive either way, so the Adafruit
+ *	build (USELIBRARY 1) does no batching by default. Set to 0 to hand
+ *	each segment over as it arrives.
+ */
 
+#ifndef G3D_POLYLINE
+#if G3D_PACKED
+#define G3D_POLYLINE		8
+#else
+#define G3D_POLYLINE		0
+#endif
+#endif
+
+#include <stddef.h>
 #include <stdint.h>
 #include "G3DMath.h"
 
+/*
+ *	G3D_STATS set to 1 keeps counts of the work done by each stage of
+ *	the pipeline in a G3DStats block, read with G3D::getStats and reset
+ *	with G3D::clearStats. Set to 2 to also accumulate the time spent in
+ *	each stage. With 0 (the default) nothing is counted.
+ */
+
+#ifndef G3D_STATS
+#define G3D_STATS			0
+#endif
+
+#if G3D_STATS > 1
+#if defined(ARDUINO)
+#include <Arduino.h>
+typedef uint32_t G3DTicks;
+#define G3D_TICKSPERUS		1		// micros()
+#else
+#include <chrono>
+typedef uint64_t G3DTicks;
+#define G3D_TICKSPERUS		1000	// steady_clock nanoseconds
+#endif
+#endif
+
+/*
+ *	With G3D_GUARDBAND set to n, a line which is in front of the camera
+ *	but sticks out past the sides of the view is clipped in 2D, in
+ *	integer screen coordinates, if both ends lie within n times the
+ *	width and height of the view. This replaces the Liang-Barsky
+ *	divisions with a cheap Cohen-Sutherland clip. Lines crossing the
+ *	near or far planes are still clipped in 3D. The wider screen range
+ *	does not fit in G3D_FIXED8.
+ */
+
+#ifndef G3D_GUARDBAND
+#define G3D_GUARDBAND		0
+#endif
+
+#if (G3D_GUARDBAND > 0) && (G3DSCALAR == G3D_FIXED8)
+#error G3D_GUARDBAND is not supported with G3D_FIXED8
+#endif
+
+/*
+ *	With G3D_BANDS set to n, the viewport can be drawn as n horizontal
+ *	bands through a display buffer only one band high. Stages 4 through
+ *	2 run once, and stage 1 records each segment in the band it starts
+ *	in; each band is then drawn in turn with G3D::drawBand and sent to
+ *	the display. G3D_BANDHEIGHT gives the rows in each band (rounded up
+ *	to a whole 8 row page) for a viewport of height h.
+ */
+
+#ifndef G3D_BANDS
+#define G3D_BANDS			0
+#endif
+
+#define G3D_BANDHEIGHT(h)	((((h) + G3D_BANDS - 1) / G3D_BANDS + 7) & ~7)
+
+/*
+ *	G3D_PARALLEL set to 1 builds G3DParallel (G3DParallel.h), which runs
+ *	G3D::transformBatch and G3D::drawBatch on a pool of threads for large
+ *	wireframes. This needs a desktop build with G3DFrameBuffer.
+ */
+
+#ifndef G3D_PARALLEL
+#define G3D_PARALLEL		0
+#endif
+
+#if G3D_PARALLEL && ((USELIBRARY != 3) || defined(ARDUINO))
+#error G3D_PARALLEL requires a desktop build with USELIBRARY=3
+#endif
+#include "G3DMesh.h"
+#include "G3DList.h"
+#include "G3DBatch.h"
+
 #if USELIBRARY == 1
 #include <Adafruit_GFX.h>    // Core graphics library
 #elif USELIBRARY == 2
 #include <Arduboy.h>
+#elif USELIBRARY == 3
+#include "G3DBuffer.h"
+#endif
+
+/*
+ *	Results of object culling. See G3D::cullSphere and G3D::cullBox
+ */
+
+#define G3D_OUTSIDE			0	// Entirely outside the view volume
+#define G3D_PARTIAL			1	// Crosses the view volume boundary
+#define G3D_INSIDE			2	// Entirely inside the view volume
+
+/*
+ *	Stage 3 keeps the last point and its outcode to clip the next line
+ *	from. Drawing without clipping bypasses stage 3, so turning clipping
+ *	back on marks the last point unknown with G3D_NOPOINT (outcodes only
+ *	use the low six bits), and the next draw acts as a move.
+ */
+
+#define G3D_NOPOINT			0x80
+
+/*	G3DSegment
+ *
+ *		A line segment in screen coordinates, as drawn by stage 1. A
+ *	single point is stored with both ends the same.
+ */
+
+struct G3DSegment {
+	uint16_t x1;
+	uint16_t y1;
+	uint16_t x2;
+	uint16_t y2;
+};
+
+/*	G3DBandSegment
+ *
+ *		A segment recorded for band drawing, with its color and the
+ *	index of the next segment in the same band.
+ */
+
+#define G3D_NOSEGMENT		0xFFFF
+
+struct G3DBandSegment {
+	uint16_t x1;
+	uint16_t y1;
+	uint16_t x2;
+	uint16_t y2;
+	uint16_t color;
+	uint16_t next;
+};
+
+#if G3D_STATS > 0
+
+/*	G3DStats
+ *
+ *		Work done by the pipeline since the last G3D::clearStats. A
+ *	segment is a line between two transformed vertices, as seen by
+ *	stage 3; the pixel counts are the pixels stage 1 plotted, or handed
+ *	to the display library.
+ */
+
+struct G3DStats {
+	uint32_t vertices;			// stage 4: vertices transformed
+	uint32_t accepted;			// stage 3: segments entirely inside
+	uint32_t rejected;			// stage 3: segments entirely outside
+	uint32_t clipped;			// stage 3: segments clipped in 3D
+	uint32_t guardBand;			// stage 3: segments clipped in 2D
+	uint32_t divisions;			// stage 3: Liang-Barsky divisions
+	uint32_t lines;				// stage 1: lines drawn
+	uint32_t points;			// stage 1: points drawn
+	uint32_t pixels;			// stage 1: pixels drawn
+#if G3D_STATS > 1
+	G3DTicks time[4];			// stage n in time[n-1], G3D_TICKSPERUS
+#endif
+};
+
 #endif
 
 /********************************************************************/
@@ -41,45 +238,141 @@ class G3D
                 G3D(Adafruit_GFX &lib, uint16_t x, uint16_t y, uint16_t width, uint16_t height);
 #elif USELIBRARY == 2
                 G3D(Arduboy &lib, uint16_t x, uint16_t y, uint16_t width, uint16_t height);
+#elif USELIBRARY == 3
+                G3D(G3DFrameBuffer &lib, uint16_t x, uint16_t y, uint16_t width, uint16_t height);
 #endif
                 ~G3D();
 
-#if USELIBRARY == 1
+#if (USELIBRARY == 1) || (USELIBRARY == 3)
 		void	setColor(uint16_t c)
 					{
+						if (c != color) p1flush();
 						color = c;
 					}
 #elif USELIBRARY == 2
 		void	setColor(uint8_t c)
 					{
+						if (c != color) p1flush();
 						color = c;
 					}
 #endif
 	
         void    begin();
         void    end();
-        void    move(float x, float y, float z)
+
+        void	setDamageBuffer(G3DSegment *buffer, uint16_t size);
+        void	clearDamage();
+        void	erase(uint16_t c);
+
+#if G3D_BANDS > 0
+        void	setBandBuffer(G3DBandSegment *buffer, uint16_t size);
+        void	drawBand(uint8_t band);
+        uint16_t bandHeight() const
+        			{
+        				return bandRows;
+        			}
+        bool	bandOverflow() const
+        			{
+        				return bandDropped;
+        			}
+#endif
+        void    move(G3DScalar x, G3DScalar y, G3DScalar z)
         			{
         				p4movedraw(false,x,y,z);
         			}
-        void    draw(float x, float y, float z)
+        void    draw(G3DScalar x, G3DScalar y, G3DScalar z)
         			{
         				p4movedraw(true,x,y,z);
         			}
-        void    point(float x, float y, float z)
+        void    point(G3DScalar x, G3DScalar y, G3DScalar z)
         			{
         				p4point(x,y,z);
         			}
                 
-        void	translate(float x, float y, float z);
-        void	scale(float x, float y, float z);
-        void	scale(float s);
-        void    rotate(uint8_t axis, float angle);
-        void	perspective(float fov, float nclip);
+        void	translate(G3DScalar x, G3DScalar y, G3DScalar z);
+        void	scale(G3DScalar x, G3DScalar y, G3DScalar z);
+        void	scale(G3DScalar s);
+        void    rotate(uint8_t axis, G3DScalar angle);
+        void    rotateAngle(uint8_t axis, G3DAngle angle);
+        void	perspective(G3DScalar fov, G3DScalar nclip);
         void	orthographic(void);
+
+        bool	push();
+        bool	pop();
+        void	load(const G3DMatrix &m)
+        			{
+        				transformation = m;
+        			}
+
+        void	setMeshBuffer(G3DMeshVertex *buffer, uint16_t size)
+        			{
+        				meshBuffer = buffer;
+        				meshBufferSize = size;
+        			}
+        void	drawMesh(const G3DMesh &mesh);
+        void	setFaceBuffer(uint8_t *buffer, uint16_t size)
+        			{
+        				faceBuffer = buffer;
+        				faceBufferSize = size;
+        			}
+        void	drawSolidMesh(const G3DSolidMesh &mesh);
+        float	pixelScale(G3DScalar x, G3DScalar y, G3DScalar z, G3DScalar radius);
+        uint8_t	selectLOD(const G3DLODMesh &mesh, G3DScalar pixels);
+        uint8_t	drawLODMesh(const G3DLODMesh &mesh, G3DScalar pixels);
+        void	drawLODLevel(const G3DLODMesh &mesh, uint8_t level, uint8_t cull = G3D_PARTIAL);
+        void	drawInstances(const G3DMesh &mesh, uint16_t count, const G3DScalar *offsets);
+        bool	drawCompactMesh(const uint8_t *data, uint32_t length)
+        			{
+        				return drawCompact(data,length,false);
+        			}
+        bool	drawCompactMesh_P(const uint8_t *data, uint32_t length)
+        			{
+        				return drawCompact(data,length,true);
+        			}
+
+        void	drawList(const uint8_t *ops, const G3DScalar *vertices);
+        void	drawList(const G3DDisplayList &list)
+        			{
+        				drawList(list.opcodes(),list.vertexData());
+        			}
+        void	drawList_P(const uint8_t *ops, const G3DScalar *vertices);
+
+        void	transformBatch(const G3DScalar *x, const G3DScalar *y, const G3DScalar *z, G3DBatch &out)
+        			{
+#if G3D_STATS > 0
+        				stats.vertices += out.count;
+#endif
+        				G3DBatchTransform(transformation,x,y,z,out);
+        			}
+        void	drawBatch(const G3DBatch &batch, uint32_t edgeCount, const uint32_t *edges);
+
+        uint8_t	cullSphere(G3DScalar x, G3DScalar y, G3DScalar z, G3DScalar radius);
+        uint8_t	cullBox(G3DScalar x1, G3DScalar y1, G3DScalar z1, G3DScalar x2, G3DScalar y2, G3DScalar z2);
+        void	setClipping(bool flag)
+        			{
+        				if (flag && !p3clip) p3outcode = G3D_NOPOINT;
+        				p3clip = flag;
+        			}
         
+#if G3D_STATS > 0
+        const G3DStats &getStats() const
+        			{
+        				return stats;
+        			}
+        void	clearStats();
+#endif
+
         G3DMatrix transformation;
     private:
+#if G3D_STACKDEPTH > 0
+        /*
+         *	Matrix stack
+         */
+
+        G3DMatrix stack[G3D_STACKDEPTH];
+        uint8_t stackDepth;
+#endif
+
         /*
          *  Internal state
          */
@@ -87,6 +380,8 @@ class G3D
         Adafruit_GFX &lib;
 #elif USELIBRARY == 2
         Arduboy &lib;
+#elif USELIBRARY == 3
+        G3DFrameBuffer &lib;
 #endif
 
 		uint16_t xoffset;
@@ -98,28 +393,103 @@ class G3D
          *	Current drawing color
          */
         
-#if USELIBRARY == 1
+#if (USELIBRARY == 1) || (USELIBRARY == 3)
         uint16_t color;
 #elif USELIBRARY == 2
         uint8_t color;
 #endif
+
+        /*
+         *	Mesh scratch space
+         */
+
+        G3DMeshVertex *meshBuffer;
+        uint16_t meshBufferSize;
+        uint8_t *faceBuffer;			// one bit per face
+        uint16_t faceBufferSize;		// bytes
+
+        void	drawMeshEdges(const G3DMesh &mesh, const G3DMeshVertex *v);
+        bool	drawCompact(const uint8_t *data, uint32_t length, bool flash);
+
+        /*
+         *	Damage tracking. Segments drawn by stage 1 are recorded so
+         *	they can be erased; if the buffer overflows we fall back to
+         *	the bounding rectangle of everything drawn.
+         */
+
+        G3DSegment *damage;
+        uint16_t damageSize;
+        uint16_t damageCount;
+        bool	damageOverflow;
+        uint16_t damageLeft;
+        uint16_t damageTop;
+        uint16_t damageRight;
+        uint16_t damageBottom;
+
+#if G3D_STATS > 0
+        /*
+         *	Statistics. With timing, statsStage is the stage we are in
+         *	(0 outside the pipeline) and statsMark when we entered it.
+         */
+
+        G3DStats stats;
+#if G3D_STATS > 1
+        uint8_t	statsStage;
+        G3DTicks statsMark;
+
+        friend class G3DStageScope;
+        uint8_t	enterStage(uint8_t stage);
+#endif
+#endif
+
+#if G3D_PARALLEL
+        /*
+         *	Parallel drawing. A worker pipeline records the segments
+         *	stage 1 would draw into p1capture rather than drawing them.
+         */
+
+        friend class G3DParallel;
+        G3DSegment *p1capture;
+        uint32_t p1captureCount;
+#endif
+
+#if G3D_BANDS > 0
+        /*
+         *	Band drawing. Segments are recorded in the order drawn, and
+         *	linked into a list for the band they start in; a segment is
+         *	moved on to the next band's list once its band is drawn.
+         */
+
+        G3DBandSegment *bandBuffer;
+        uint16_t bandSize;
+        uint16_t bandCount;
+        bool	bandDropped;
+        uint16_t bandRows;
+        uint16_t bandHead[G3D_BANDS];
+        uint16_t bandTail[G3D_BANDS];
+
+        void	clearBands();
+#endif
       
         /*
          *	Stage 4 pipeline; 3D transformation
          */
         
-        void	p4point(float x, float y, float z);
-        void	p4movedraw(bool drawFlag, float x, float y, float z);
+        void	p4point(G3DScalar x, G3DScalar y, G3DScalar z);
+        void	p4movedraw(bool drawFlag, G3DScalar x, G3DScalar y, G3DScalar z);
+        void	p4transform(G3DScalar x, G3DScalar y, G3DScalar z, G3DVector &t);
         
         /*
          *	Stage 3 pipeline; 3D clipping engine
          */
         
         G3DVector p3pos;
-        uint8_t	p3outcode;
+        uint8_t	p3outcode;				// or G3D_NOPOINT
+        bool	p3clip;
         
         void	p3init();
         void	p3movedraw(bool drawFlag, const G3DVector &v);
+        void	p3movedraw(bool drawFlag, const G3DVector &v, uint8_t newOutCode);
         void	p3point(const G3DVector &v);
         
         /*
@@ -127,15 +497,18 @@ class G3D
          */
         
         void	p2init();
-        void	p2movedraw(bool drawFlag, float x, float y);
-        void	p2point(float x, float y);
+        void	p2movedraw(bool drawFlag, G3DScalar x, G3DScalar y);
+        void	p2point(G3DScalar x, G3DScalar y);
+#if G3D_GUARDBAND > 0
+        void	p2clipdraw(bool moveFlag, G3DScalar x0, G3DScalar y0, G3DScalar x1, G3DScalar y1);
+#endif
         
-        float	p2xsize;		// viewport width +/-
-        float	p2ysize;		// viewport height +/-
-        float	p2xscale;		// coordinate transform scale.
-        float	p2yscale;
-        float	p2xoff;			// coordinate transform offset
-        float	p2yoff;
+        G3DScalar	p2xsize;		// viewport width +/-
+        G3DScalar	p2ysize;		// viewport height +/-
+        G3DScalar	p2xscale;		// coordinate transform scale.
+        G3DScalar	p2yscale;
+        G3DScalar	p2xoff;			// coordinate transform offset
+        G3DScalar	p2yoff;
 
         /*
          *  Stage 1 pipeline
@@ -144,8 +517,33 @@ class G3D
         bool    p1draw;
         uint16_t p1x;
         uint16_t p1y;
+
+#if G3D_POLYLINE > 1
+        struct {
+            uint16_t x;
+            uint16_t y;
+        }       p1line[G3D_POLYLINE];	// pending polyline
+        uint8_t p1count;				// points in p1line
+        bool    p1cont;					// p1line[0] already plotted
+
+#endif
+
+#if G3D_PACKED
+        uint8_t *p1buffer;				// page packed buffer, or NULL
+        uint16_t p1stride;				// bytes per page
+
+        void	p1packed(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, bool skipFirst);
+#endif
         
         void	p1init();
+        void	p1segment(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, bool skipFirst);
+        void	p1damage(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2);
+        void	p1fillrect(uint16_t x, uint16_t y, uint16_t w, uint16_t h);
+        void	p1flush();
+#if G3D_BANDS > 0
+        void	p1bin(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2);
+        void	p1band(const G3DBandSegment &seg, uint16_t top, uint16_t bottom);
+#endif
         void    p1movedraw(bool drawFlag, uint16_t x, uint16_t y);
         void	p1point(uint16_t x, uint16_t y);
 };
@@ -0,0 +1,207 @@
+/*  G3DBatch.cpp
+ *
+ *      Batch vertex transformation
+ */
+
+#include <string.h>
+#include "G3DBatch.h"
+
+#if (G3DSCALAR == G3D_FLOAT) && defined(__AVX__)
+#include <immintrin.h>
+#define G3D_BATCHWIDTH		8
+#elif (G3DSCALAR == G3D_FLOAT) && defined(__SSE2__)
+#include <emmintrin.h>
+#define G3D_BATCHWIDTH		4
+#else
+#define G3D_BATCHWIDTH		1
+#endif
+
+/********************************************************************/
+/*                                                                  */
+/*  Scalar Transform												*/
+/*                                                                  */
+/********************************************************************/
+
+/*	OutCode
+ *
+ *		Calculate the outcode of a transformed vertex. This must match
+ *	the OutCode routine used by the clipper in G3D.cpp.
+ */
+
+static inline uint8_t OutCode(G3DScalar x, G3DScalar y, G3DScalar z, G3DScalar w)
+{
+    uint8_t m = 0;
+
+    if (x < -w) m |= 1;
+    if (x > w) m |= 2;
+    if (y < -w) m |= 4;
+    if (y > w) m |= 8;
+    if (z < -w) m |= 16;
+    if (z > 0) m |= 32;
+
+    return m;
+}
+
+/*	TransformScalar
+ *
+ *		Transform vertices start through count-1 one at a time
+ */
+
+static void TransformScalar(const G3DMatrix &m, const G3DScalar *x, const G3DScalar *y, const G3DScalar *z, G3DBatch &out, uint32_t start)
+{
+    for (uint32_t i = start; i < out.count; ++i) {
+        G3DScalar tx = m.a[0][0] * x[i] + m.a[0][1] * y[i] + m.a[0][2] * z[i] + m.a[0][3];
+        G3DScalar ty = m.a[1][0] * x[i] + m.a[1][1] * y[i] + m.a[1][2] * z[i] + m.a[1][3];
+        G3DScalar tz = m.a[2][0] * x[i] + m.a[2][1] * y[i] + m.a[2][2] * z[i] + m.a[2][3];
+        G3DScalar tw = m.a[3][0] * x[i] + m.a[3][1] * y[i] + m.a[3][2] * z[i] + m.a[3][3];
+
+        out.x[i] = tx;
+        out.y[i] = ty;
+        out.z[i] = tz;
+        out.w[i] = tw;
+        out.outcode[i] = OutCode(tx,ty,tz,tw);
+    }
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Vector Transform												*/
+/*                                                                  */
+/********************************************************************/
+
+/*
+ *	Each row of the matrix is applied as ((a0*x + a1*y) + a2*z) + a3, the
+ *	same order of operations as the scalar path, so the results (and
+ *	the outcodes) are bit for bit identical.
+ *
+ *	Outcodes are assembled by masking each comparison result with the
+ *	bit for that clipping wall and or-ing them together per lane.
+ */
+
+#if G3D_BATCHWIDTH == 8
+
+static void TransformVector(const G3DMatrix &m, const G3DScalar *x, const G3DScalar *y, const G3DScalar *z, G3DBatch &out, uint32_t count)
+{
+    __m256 r[4][4];
+    for (uint8_t i = 0; i < 4; ++i) {
+        for (uint8_t j = 0; j < 4; ++j) {
+            r[i][j] = _mm256_set1_ps(m.a[i][j]);
+        }
+    }
+
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 bit[6];
+    for (uint8_t i = 0; i < 6; ++i) {
+        bit[i] = _mm256_castsi256_ps(_mm256_set1_epi32(1 << i));
+    }
+
+    for (uint32_t i = 0; i < count; i += 8) {
+        __m256 vx = _mm256_loadu_ps(x + i);
+        __m256 vy = _mm256_loadu_ps(y + i);
+        __m256 vz = _mm256_loadu_ps(z + i);
+        __m256 t[4];
+
+        for (uint8_t j = 0; j < 4; ++j) {
+            t[j] = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+                        _mm256_mul_ps(r[j][0],vx),
+                        _mm256_mul_ps(r[j][1],vy)),
+                        _mm256_mul_ps(r[j][2],vz)),
+                        r[j][3]);
+        }
+
+        _mm256_storeu_ps(out.x + i,t[0]);
+        _mm256_storeu_ps(out.y + i,t[1]);
+        _mm256_storeu_ps(out.z + i,t[2]);
+        _mm256_storeu_ps(out.w + i,t[3]);
+
+        __m256 nw = _mm256_sub_ps(zero,t[3]);
+        __m256 code = _mm256_and_ps(_mm256_cmp_ps(t[0],nw,_CMP_LT_OQ),bit[0]);
+        code = _mm256_or_ps(code,_mm256_and_ps(_mm256_cmp_ps(t[0],t[3],_CMP_GT_OQ),bit[1]));
+        code = _mm256_or_ps(code,_mm256_and_ps(_mm256_cmp_ps(t[1],nw,_CMP_LT_OQ),bit[2]));
+        code = _mm256_or_ps(code,_mm256_and_ps(_mm256_cmp_ps(t[1],t[3],_CMP_GT_OQ),bit[3]));
+        code = _mm256_or_ps(code,_mm256_and_ps(_mm256_cmp_ps(t[2],nw,_CMP_LT_OQ),bit[4]));
+        code = _mm256_or_ps(code,_mm256_and_ps(_mm256_cmp_ps(t[2],zero,_CMP_GT_OQ),bit[5]));
+
+        __m128i lo = _mm_castps_si128(_mm256_castps256_ps128(code));
+        __m128i hi = _mm_castps_si128(_mm256_extractf128_ps(code,1));
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(lo,hi),_mm_setzero_si128());
+        _mm_storel_epi64((__m128i *)(out.outcode + i),packed);
+    }
+}
+
+#elif G3D_BATCHWIDTH == 4
+
+static void TransformVector(const G3DMatrix &m, const G3DScalar *x, const G3DScalar *y, const G3DScalar *z, G3DBatch &out, uint32_t count)
+{
+    __m128 r[4][4];
+    for (uint8_t i = 0; i < 4; ++i) {
+        for (uint8_t j = 0; j < 4; ++j) {
+            r[i][j] = _mm_set1_ps(m.a[i][j]);
+        }
+    }
+
+    const __m128 zero = _mm_setzero_ps();
+    __m128 bit[6];
+    for (uint8_t i = 0; i < 6; ++i) {
+        bit[i] = _mm_castsi128_ps(_mm_set1_epi32(1 << i));
+    }
+
+    for (uint32_t i = 0; i < count; i += 4) {
+        __m128 vx = _mm_loadu_ps(x + i);
+        __m128 vy = _mm_loadu_ps(y + i);
+        __m128 vz = _mm_loadu_ps(z + i);
+        __m128 t[4];
+
+        for (uint8_t j = 0; j < 4; ++j) {
+            t[j] = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+                        _mm_mul_ps(r[j][0],vx),
+                        _mm_mul_ps(r[j][1],vy)),
+                        _mm_mul_ps(r[j][2],vz)),
+                        r[j][3]);
+        }
+
+        _mm_storeu_ps(out.x + i,t[0]);
+        _mm_storeu_ps(out.y + i,t[1]);
+        _mm_storeu_ps(out.z + i,t[2]);
+        _mm_storeu_ps(out.w + i,t[3]);
+
+        __m128 nw = _mm_sub_ps(zero,t[3]);
+        __m128 code = _mm_and_ps(_mm_cmplt_ps(t[0],nw),bit[0]);
+        code = _mm_or_ps(code,_mm_and_ps(_mm_cmpgt_ps(t[0],t[3]),bit[1]));
+        code = _mm_or_ps(code,_mm_and_ps(_mm_cmplt_ps(t[1],nw),bit[2]));
+        code = _mm_or_ps(code,_mm_and_ps(_mm_cmpgt_ps(t[1],t[3]),bit[3]));
+        code = _mm_or_ps(code,_mm_and_ps(_mm_cmplt_ps(t[2],nw),bit[4]));
+        code = _mm_or_ps(code,_mm_and_ps(_mm_cmpgt_ps(t[2],zero),bit[5]));
+
+        __m128i c = _mm_castps_si128(code);
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(c,c),c);
+        int32_t codes = _mm_cvtsi128_si32(packed);
+        memcpy(out.outcode + i,&codes,4);
+    }
+}
+
+#endif
+
+/********************************************************************/
+/*                                                                  */
+/*  Batch Transform													*/
+/*                                                                  */
+/********************************************************************/
+
+/*	G3DBatchTransform
+ *
+ *		Transform as many vertices as we can with the vector kernel,
+ *	finishing the remainder one at a time.
+ */
+
+void G3DBatchTransform(const G3DMatrix &m, const G3DScalar *x, const G3DScalar *y, const G3DScalar *z, G3DBatch &out)
+{
+    uint32_t start = 0;
+
+#if G3D_BATCHWIDTH > 1
+    start = out.count & ~(uint32_t)(G3D_BATCHWIDTH - 1);
+    TransformVector(m,x,y,z,out,start);
+#endif
+
+    TransformScalar(m,x,y,z,out,start);
+}
@@ -0,0 +1,51 @@
+/*  G3DBatch.h
+ *
+ *      Batch vertex transformation. Vertices are held as separate x, y
+ *  and z arrays (structure of arrays) so the transform and outcode can
+ *  be computed several vertices at a time with SSE2 or AVX on a desktop
+ *  machine. Elsewhere, or with a fixed point G3DSCALAR, a scalar loop
+ *  is used.
+ */
+
+#ifndef _G3DBATCH_H
+#define _G3DBATCH_H
+
+#include <stdint.h>
+#include "G3DMath.h"
+
+/********************************************************************/
+/*                                                                  */
+/*  Batch Structures												*/
+/*                                                                  */
+/********************************************************************/
+
+/*  G3DBatch
+ *
+ *      The transformed vertices and their clipping outcodes. Each of the
+ *  arrays is provided by the caller and holds count entries.
+ */
+
+struct G3DBatch {
+	uint32_t count;
+	G3DScalar *x;
+	G3DScalar *y;
+	G3DScalar *z;
+	G3DScalar *w;
+	uint8_t *outcode;
+};
+
+/********************************************************************/
+/*                                                                  */
+/*  Batch Transform													*/
+/*                                                                  */
+/********************************************************************/
+
+/*  G3DBatchTransform
+ *
+ *      Transform out.count vertices (x,y,z,1) by the matrix m, writing
+ *  x, y, z, w and the outcode of each into out.
+ */
+
+extern void G3DBatchTransform(const G3DMatrix &m, const G3DScalar *x, const G3DScalar *y, const G3DScalar *z, G3DBatch &out);
+
+#endif // _G3DBATCH_H
@@ -0,0 +1,384 @@
+/*  G3DBuffer.cpp
+ *
+ *      In-memory framebuffer and rasterizer.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "G3DBuffer.h"
+
+/********************************************************************/
+/*                                                                  */
+/*  Constructor/Destructor											*/
+/*                                                                  */
+/********************************************************************/
+
+/*	G3DFrameBuffer::G3DFrameBuffer
+ *
+ *		Construct our framebuffer. If a buffer is not provided we
+ *	allocate one of the appropriate size.
+ */
+
+G3DFrameBuffer::G3DFrameBuffer(uint8_t f, uint16_t wd, uint16_t ht, void *b)
+{
+	fmt = f;
+	w = wd;
+	h = ht;
+
+	/*
+	 *	Monochrome displays track dirty blocks. Everything starts out
+	 *	dirty so the first flush sends the whole display.
+	 */
+
+	if (fmt == G3D_FORMAT_MONO) {
+		dirtyStride = (w + G3D_DIRTYCOLUMNS - 1) / G3D_DIRTYCOLUMNS;
+		dirtySize = (dirtyStride * ((h + 7) >> 3) + 7) >> 3;
+		dirty = (uint8_t *)malloc(dirtySize);
+		lastDirty = (uint8_t *)malloc(dirtySize);
+		memset(dirty,0,dirtySize);
+		memset(lastDirty,0xFF,dirtySize);
+	} else {
+		dirtyStride = 0;
+		dirtySize = 0;
+		dirty = NULL;
+		lastDirty = NULL;
+	}
+
+	if (b) {
+		buffer = (uint8_t *)b;
+		owned = false;
+	} else {
+		buffer = (uint8_t *)malloc(bufferSize());
+		owned = true;
+		clear();
+	}
+}
+
+G3DFrameBuffer::~G3DFrameBuffer()
+{
+	if (owned) free(buffer);
+	free(dirty);
+	free(lastDirty);
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Buffer Access													*/
+/*                                                                  */
+/********************************************************************/
+
+/*	G3DFrameBuffer::bufferSize
+ *
+ *		Size of our buffer in bytes. Monochrome displays are rounded up
+ *	to the next 8 pixel page.
+ */
+
+uint32_t G3DFrameBuffer::bufferSize() const
+{
+	if (fmt == G3D_FORMAT_MONO) {
+		return (uint32_t)w * ((h + 7) >> 3);
+	} else {
+		return (uint32_t)w * h * 2;
+	}
+}
+
+/*	G3DFrameBuffer::clear
+ *
+ *		Fill the buffer with the specified color
+ */
+
+void G3DFrameBuffer::clear(uint16_t color)
+{
+	if (fmt == G3D_FORMAT_MONO) {
+		memset(buffer,color ? 0xFF : 0x00,bufferSize());
+
+		// Clearing to black only changes what was drawn, which is
+		// already marked; clearing to white changes everything.
+		if (color) memset(dirty,0xFF,dirtySize);
+	} else {
+		uint16_t *ptr = (uint16_t *)buffer;
+		uint32_t len = (uint32_t)w * h;
+		while (len--) *ptr++ = color;
+	}
+}
+
+/*	G3DFrameBuffer::getPixel
+ *
+ *		Read a pixel. Pixels off the display read as 0.
+ */
+
+uint16_t G3DFrameBuffer::getPixel(int16_t x, int16_t y) const
+{
+	if ((x < 0) || (y < 0) || (x >= (int16_t)w) || (y >= (int16_t)h)) return 0;
+
+	if (fmt == G3D_FORMAT_MONO) {
+		return (buffer[(y >> 3) * w + x] >> (y & 7)) & 1;
+	} else {
+		return ((uint16_t *)buffer)[y * w + x];
+	}
+}
+
+/*	G3DFrameBuffer::setPixel
+ *
+ *		Write a pixel which is known to be on the display.
+ */
+
+void G3DFrameBuffer::setPixel(uint16_t x, uint16_t y, uint16_t color)
+{
+	if (fmt == G3D_FORMAT_MONO) {
+		uint8_t *ptr = buffer + (y >> 3) * w + x;
+		uint8_t bit = 1 << (y & 7);
+		uint16_t block = (y >> 3) * dirtyStride + x / G3D_DIRTYCOLUMNS;
+		dirty[block >> 3] |= 1 << (block & 7);
+		if (color) {
+			*ptr |= bit;
+		} else {
+			*ptr &= ~bit;
+		}
+	} else {
+		((uint16_t *)buffer)[(uint32_t)y * w + x] = color;
+	}
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Drawing															*/
+/*                                                                  */
+/********************************************************************/
+
+/*	G3DFrameBuffer::drawPixel
+ *
+ *		Draw a pixel, discarding it if it is off the display
+ */
+
+void G3DFrameBuffer::drawPixel(int16_t x, int16_t y, uint16_t color)
+{
+	if ((x < 0) || (y < 0) || (x >= (int16_t)w) || (y >= (int16_t)h)) return;
+	setPixel(x,y,color);
+}
+
+/*	G3DFrameBuffer::drawLine
+ *
+ *		Draw a line using Bresenham's algorithm. Both endpoints are drawn.
+ *	Pixels which fall off the display are discarded.
+ */
+
+void G3DFrameBuffer::drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t color)
+{
+	int16_t dx = x1 - x0;
+	int16_t dy = y1 - y0;
+	int16_t sx = 1;
+	int16_t sy = 1;
+
+	if (dx < 0) {
+		dx = -dx;
+		sx = -1;
+	}
+	if (dy < 0) {
+		dy = -dy;
+		sy = -1;
+	}
+
+	/*
+	 *	Walk the major axis, accumulating error along the minor axis
+	 */
+
+	int16_t err = dx - dy;
+	for (;;) {
+		drawPixel(x0,y0,color);
+		if ((x0 == x1) && (y0 == y1)) break;
+
+		int16_t e2 = err * 2;
+		if (e2 > -dy) {
+			err -= dy;
+			x0 += sx;
+		}
+		if (e2 < dx) {
+			err += dx;
+			y0 += sy;
+		}
+	}
+}
+
+/*	G3DFrameBuffer::fillRect
+ *
+ *		Fill a rectangle, clipped to the display
+ */
+
+void G3DFrameBuffer::fillRect(int16_t x, int16_t y, int16_t wd, int16_t ht, uint16_t color)
+{
+	int16_t x2 = x + wd;
+	int16_t y2 = y + ht;
+	if (x < 0) x = 0;
+	if (y < 0) y = 0;
+	if (x2 > (int16_t)w) x2 = w;
+	if (y2 > (int16_t)h) y2 = h;
+
+	for (int16_t j = y; j < y2; ++j) {
+		for (int16_t i = x; i < x2; ++i) {
+			setPixel(i,j,color);
+		}
+	}
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Display Update													*/
+/*                                                                  */
+/********************************************************************/
+
+/*	G3DFrameBuffer::markLine
+ *
+ *		Mark the blocks a line drawn by someone else writing directly
+ *	into our buffer may have touched. For each page the line crosses we
+ *	find the columns it spans within that page, widened by a row either
+ *	side to cover where Bresenham rounds, and mark those blocks.
+ */
+
+void G3DFrameBuffer::markLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1)
+{
+	if (dirty == NULL) return;
+
+	if (y0 > y1) {
+		int16_t t;
+		t = x0; x0 = x1; x1 = t;
+		t = y0; y0 = y1; y1 = t;
+	}
+	if (y0 < 0) y0 = 0;
+	if (y1 >= (int16_t)h) y1 = h - 1;
+
+	int16_t dx = x1 - x0;
+	int16_t dy = y1 - y0;
+	int16_t xmin = (x0 < x1) ? x0 : x1;
+	int16_t xmax = (x0 < x1) ? x1 : x0;
+	if (xmin < 0) xmin = 0;
+	if (xmax >= (int16_t)w) xmax = w - 1;
+
+	for (int16_t page = y0 >> 3; page <= (y1 >> 3); ++page) {
+		int16_t xa = xmin;
+		int16_t xb = xmax;
+
+		if (dy > 0) {
+			int16_t ya = (page << 3) - 1;
+			int16_t yb = (page << 3) + 8;
+			xa = x0 + (int16_t)((int32_t)(ya - y0) * dx / dy);
+			xb = x0 + (int16_t)((int32_t)(yb - y0) * dx / dy);
+			if (xa > xb) {
+				int16_t t = xa;
+				xa = xb;
+				xb = t;
+			}
+			--xa;		// division truncates
+			++xb;
+			if (xa < xmin) xa = xmin;
+			if (xb > xmax) xb = xmax;
+		}
+
+		uint16_t block = page * dirtyStride + xa / G3D_DIRTYCOLUMNS;
+		uint16_t last = page * dirtyStride + xb / G3D_DIRTYCOLUMNS;
+		for (; block <= last; ++block) {
+			dirty[block >> 3] |= 1 << (block & 7);
+		}
+	}
+}
+
+/*	G3DFrameBuffer::markRect
+ *
+ *		Mark the blocks of a rectangle written into directly by someone
+ *	else, clipped to the display.
+ */
+
+void G3DFrameBuffer::markRect(int16_t x, int16_t y, int16_t wd, int16_t ht)
+{
+	if (dirty == NULL) return;
+
+	int16_t x2 = x + wd;
+	int16_t y2 = y + ht;
+	if (x < 0) x = 0;
+	if (y < 0) y = 0;
+	if (x2 > (int16_t)w) x2 = w;
+	if (y2 > (int16_t)h) y2 = h;
+	if ((x >= x2) || (y >= y2)) return;
+
+	for (int16_t page = y >> 3; page <= ((y2 - 1) >> 3); ++page) {
+		uint16_t block = page * dirtyStride + x / G3D_DIRTYCOLUMNS;
+		uint16_t last = page * dirtyStride + (x2 - 1) / G3D_DIRTYCOLUMNS;
+		for (; block <= last; ++block) {
+			dirty[block >> 3] |= 1 << (block & 7);
+		}
+	}
+}
+
+/*	G3DFrameBuffer::flush
+ *
+ *		Send the blocks of a monochrome display which changed since the
+ *	last flush to an SSD1306 style controller (as used by the Arduboy).
+ *	A block changed if it was drawn into this frame, or drawn into last
+ *	frame and since cleared. Each run of changed blocks within a page is
+ *	sent as one window, using horizontal addressing mode: the column
+ *	address (0x21) and page address (0x22) commands, then the data.
+ */
+
+void G3DFrameBuffer::flush(G3DDisplaySink &sink)
+{
+	if (fmt != G3D_FORMAT_MONO) return;
+
+	uint16_t pages = (h + 7) >> 3;
+	for (uint16_t page = 0; page < pages; ++page) {
+		uint16_t block = page * dirtyStride;
+		uint16_t i = 0;
+		while (i < dirtyStride) {
+			/*
+			 *	Find the next run of changed blocks
+			 */
+
+			uint16_t b = block + i;
+			if (!((dirty[b >> 3] | lastDirty[b >> 3]) & (1 << (b & 7)))) {
+				++i;
+				continue;
+			}
+
+			uint16_t start = i;
+			do {
+				++i;
+				b = block + i;
+			} while ((i < dirtyStride) && ((dirty[b >> 3] | lastDirty[b >> 3]) & (1 << (b & 7))));
+
+			uint16_t x1 = start * G3D_DIRTYCOLUMNS;
+			uint16_t x2 = i * G3D_DIRTYCOLUMNS;
+			if (x2 > w) x2 = w;
+
+			sink.command(0x21);
+			sink.command(x1);
+			sink.command(x2 - 1);
+			sink.command(0x22);
+			sink.command(page);
+			sink.command(page);
+			sink.data(buffer + page * w + x1,x2 - x1);
+		}
+	}
+
+	memcpy(lastDirty,dirty,dirtySize);
+	memset(dirty,0,dirtySize);
+}
+
+/*	G3DFrameBuffer::flushPages
+ *
+ *		Send the whole of a monochrome buffer to the display, as the
+ *	pages starting at page. This is used when drawing in bands, where a
+ *	buffer one band high is reused for every band of the display, so
+ *	dirty blocks mean nothing.
+ */
+
+void G3DFrameBuffer::flushPages(G3DDisplaySink &sink, uint8_t page)
+{
+	if (fmt != G3D_FORMAT_MONO) return;
+
+	sink.command(0x21);
+	sink.command(0);
+	sink.command(w - 1);
+	sink.command(0x22);
+	sink.command(page);
+	sink.command(page + ((h + 7) >> 3) - 1);
+	sink.data(buffer,bufferSize());
+}
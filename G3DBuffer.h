@@ -0,0 +1,139 @@
+/*  G3DBuffer.h
+ *
+ *      A simple in-memory framebuffer. This gives the pipeline a drawing
+ *  target which does not depend on any display library, so the whole
+ *  pipeline can be built and profiled on a desktop machine.
+ */
+
+#ifndef _G3DBUFFER_H
+#define _G3DBUFFER_H
+
+#include <stdint.h>
+
+/********************************************************************/
+/*                                                                  */
+/*  Pixel formats													*/
+/*                                                                  */
+/********************************************************************/
+
+/*
+ *	G3D_FORMAT_MONO is a 1-bit display organized as the Arduboy (and
+ *	the underlying SSD1306) lays out memory: each byte is a vertical
+ *	run of 8 pixels, least significant bit at the top, and the bytes
+ *	are arranged in pages of 8 rows, width bytes per page.
+ *
+ *	G3D_FORMAT_RGB565 is a 16-bit display as used by the ILI9341, with
+ *	one uint16_t per pixel arranged row by row.
+ */
+
+#define G3D_FORMAT_MONO		0
+#define G3D_FORMAT_RGB565	1
+
+/*
+ *	Monochrome buffers track which blocks of G3D_DIRTYCOLUMNS columns
+ *	in each 8 row page have been drawn into, so flush() only has to
+ *	send the blocks which changed.
+ */
+
+#define G3D_DIRTYCOLUMNS	8
+
+/********************************************************************/
+/*                                                                  */
+/*  G3DDisplaySink													*/
+/*                                                                  */
+/********************************************************************/
+
+/*  G3DDisplaySink
+ *
+ *      The connection to a display controller used by
+ *  G3DFrameBuffer::flush. This is typically a thin wrapper around SPI
+ *  which sets the controller's D/C line for commands and data.
+ */
+
+class G3DDisplaySink
+{
+    public:
+        virtual ~G3DDisplaySink()
+                    {
+                    }
+
+        virtual void command(uint8_t c) = 0;
+        virtual void data(const uint8_t *data, uint16_t length) = 0;
+};
+
+/********************************************************************/
+/*                                                                  */
+/*  G3DFrameBuffer													*/
+/*                                                                  */
+/********************************************************************/
+
+/*  G3DFrameBuffer
+ *
+ *      Framebuffer and rasterizer. The buffer is either allocated by
+ *  this object or supplied by the caller (so we can wrap the buffer
+ *  owned by another display library).
+ */
+
+class G3DFrameBuffer
+{
+    public:
+                G3DFrameBuffer(uint8_t format, uint16_t width, uint16_t height, void *buffer = 0);
+                ~G3DFrameBuffer();
+
+        void    clear(uint16_t color = 0);
+        void    drawPixel(int16_t x, int16_t y, uint16_t color);
+        void    drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t color);
+        void    fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color);
+        uint16_t getPixel(int16_t x, int16_t y) const;
+
+        uint8_t format() const
+                    {
+                        return fmt;
+                    }
+        uint16_t width() const
+                    {
+                        return w;
+                    }
+        uint16_t height() const
+                    {
+                        return h;
+                    }
+        uint8_t *getBuffer()
+                    {
+                        return buffer;
+                    }
+        uint32_t bufferSize() const;
+
+        void    markLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1);
+        void    markRect(int16_t x, int16_t y, int16_t w, int16_t h);
+        void    flush(G3DDisplaySink &sink);
+        void    flushPages(G3DDisplaySink &sink, uint8_t page);
+
+    private:
+        uint8_t fmt;
+        uint16_t w;
+        uint16_t h;
+        uint8_t *buffer;
+        bool    owned;
+
+        /*
+         *  Dirty blocks drawn into since the last flush, and drawn into
+         *  before that (which a clear will have erased)
+         */
+
+        uint8_t *dirty;
+        uint8_t *lastDirty;
+        uint16_t dirtyStride;       // blocks per page
+        uint16_t dirtySize;         // bytes in each dirty array
+
+        void    setPixel(uint16_t x, uint16_t y, uint16_t color);
+
+        /*
+         *  Not copyable: the buffers may be ours to free
+         */
+
+                G3DFrameBuffer(const G3DFrameBuffer &) = delete;
+        G3DFrameBuffer &operator = (const G3DFrameBuffer &) = delete;
+};
+
+#endif // _G3DBUFFER_H
@@ -0,0 +1,275 @@
+/*  G3DFixed.h
+ *
+ *      Fixed point arithmetic. On processors without an FPU (such as the
+ *  AVR) every float operation goes through a soft-float library; this
+ *  provides a fixed point scalar which may be used by the pipeline instead.
+ *  See G3DSCALAR in G3DMath.h.
+ */
+
+#ifndef _G3DFIXED_H
+#define _G3DFIXED_H
+
+#include <stdint.h>
+
+/********************************************************************/
+/*                                                                  */
+/*  G3DFixedPoint													*/
+/*                                                                  */
+/********************************************************************/
+
+/*  G3DFixedPoint
+ *
+ *      A signed fixed point value stored in T with F fractional bits.
+ *  Addition, subtraction and negation are done in T, and Q16.16
+ *  multiplies and divides in 32 bits; W is a type at least twice as
+ *  wide as T, used only for the Q8.8 products and quotients and for
+ *  converting integers. All arithmetic saturates rather than wrapping
+ *  around, so a value which overflows pins to the largest (or smallest)
+ *  value; this keeps our clipping math well behaved when coordinates
+ *  get large.
+ *
+ *      Constructors are constexpr so constants fold at compile time;
+ *  converting a float at runtime still requires soft-float.
+ */
+
+template <typename T, typename W, uint8_t F>
+class G3DFixedPoint
+{
+    public:
+        constexpr G3DFixedPoint() : v(0)
+                    {
+                    }
+        constexpr G3DFixedPoint(int i) : v(sat((W)i * ONE))
+                    {
+                    }
+        constexpr G3DFixedPoint(unsigned int i) : v(sat((W)i * ONE))
+                    {
+                    }
+        constexpr G3DFixedPoint(long i) : v(sat((W)i * ONE))
+                    {
+                    }
+        constexpr G3DFixedPoint(unsigned long i) : v(sat((W)i * ONE))
+                    {
+                    }
+        constexpr G3DFixedPoint(float f) : v(fromFloat(f))
+                    {
+                    }
+        constexpr G3DFixedPoint(double f) : v(fromFloat((float)f))
+                    {
+                    }
+
+        /*
+         *  Construct from a raw fixed point value
+         */
+
+        static G3DFixedPoint raw(T r)
+                    {
+                        G3DFixedPoint ret;
+                        ret.v = r;
+                        return ret;
+                    }
+
+        /*
+         *  Conversion
+         */
+
+        float   toFloat() const
+                    {
+                        return ((float)v) / (float)ONE;
+                    }
+        int16_t toInt() const
+                    {
+                        return (int16_t)(v >> F);
+                    }
+
+        /*
+         *  Arithmetic
+         */
+
+        G3DFixedPoint operator - () const
+                    {
+                        return raw((v == MINRAW) ? MAXRAW : (T)-v);
+                    }
+
+        friend G3DFixedPoint operator + (G3DFixedPoint a, G3DFixedPoint b)
+                    {
+                        return raw(add(a.v,b.v));
+                    }
+        friend G3DFixedPoint operator - (G3DFixedPoint a, G3DFixedPoint b)
+                    {
+                        return raw(sub(a.v,b.v));
+                    }
+        friend G3DFixedPoint operator * (G3DFixedPoint a, G3DFixedPoint b)
+                    {
+                        if ((sizeof(T) == 4) && (F == 16)) return raw(mul16(a.v,b.v));
+                        return raw(sat(((W)a.v * (W)b.v) >> F));
+                    }
+        friend G3DFixedPoint operator / (G3DFixedPoint a, G3DFixedPoint b)
+                    {
+                        if (b.v == 0) return raw((a.v < 0) ? MINRAW : MAXRAW);
+                        if ((sizeof(T) == 4) && (F == 16)) return raw(div16(a.v,b.v));
+                        return raw(sat(((W)a.v * ONE) / b.v));
+                    }
+
+        G3DFixedPoint &operator += (G3DFixedPoint a)
+                    {
+                        return *this = *this + a;
+                    }
+        G3DFixedPoint &operator -= (G3DFixedPoint a)
+                    {
+                        return *this = *this - a;
+                    }
+        G3DFixedPoint &operator *= (G3DFixedPoint a)
+                    {
+                        return *this = *this * a;
+                    }
+        G3DFixedPoint &operator /= (G3DFixedPoint a)
+                    {
+                        return *this = *this / a;
+                    }
+
+        /*
+         *  Comparison
+         */
+
+        friend bool operator == (G3DFixedPoint a, G3DFixedPoint b)
+                    {
+                        return a.v == b.v;
+                    }
+        friend bool operator != (G3DFixedPoint a, G3DFixedPoint b)
+                    {
+                        return a.v != b.v;
+                    }
+        friend bool operator < (G3DFixedPoint a, G3DFixedPoint b)
+                    {
+                        return a.v < b.v;
+                    }
+        friend bool operator > (G3DFixedPoint a, G3DFixedPoint b)
+                    {
+                        return a.v > b.v;
+                    }
+        friend bool operator <= (G3DFixedPoint a, G3DFixedPoint b)
+                    {
+                        return a.v <= b.v;
+                    }
+        friend bool operator >= (G3DFixedPoint a, G3DFixedPoint b)
+                    {
+                        return a.v >= b.v;
+                    }
+
+        // Raw contents
+        T       v;
+
+    private:
+        static constexpr W ONE = ((W)1) << F;
+        static constexpr T MAXRAW = (T)((((W)1) << (sizeof(T) * 8 - 1)) - 1);
+        static constexpr T MINRAW = (T)(-MAXRAW - 1);
+
+        static constexpr T sat(W x)
+                    {
+                        return (x > (W)MAXRAW) ? MAXRAW : ((x < (W)MINRAW) ? MINRAW : (T)x);
+                    }
+        /*
+         *  Add and subtract with the wrap done in unsigned arithmetic.
+         *  The sum overflowed if both operands have the sign the result
+         *  lacks, and the difference if the operands differ in sign and
+         *  the result's sign is not the first operand's.
+         */
+
+        static T    add(T a, T b)
+                    {
+                        T r = (T)((uint32_t)a + (uint32_t)b);
+                        if (((a ^ r) & (b ^ r)) < 0) return (a < 0) ? MINRAW : MAXRAW;
+                        return r;
+                    }
+        static T    sub(T a, T b)
+                    {
+                        T r = (T)((uint32_t)a - (uint32_t)b);
+                        if (((a ^ b) & (a ^ r)) < 0) return (a < 0) ? MINRAW : MAXRAW;
+                        return r;
+                    }
+
+        /*
+         *  Q16.16 multiply and divide without 64 bit arithmetic, which
+         *  the AVR only has through slow library routines. Both work on
+         *  magnitudes and give the same result as the 64 bit versions:
+         *  the product rounds down and the quotient toward zero.
+         *
+         *  The product is built from four 16 x 16 -> 32 bit multiplies
+         *  of the halves of each magnitude, of which only the bits from
+         *  16 up are kept.
+         */
+
+        static T    mul16(T a, T b)
+                    {
+                        bool neg = (a < 0) != (b < 0);
+                        uint32_t ua = (a < 0) ? -(uint32_t)a : (uint32_t)a;
+                        uint32_t ub = (b < 0) ? -(uint32_t)b : (uint32_t)b;
+                        uint16_t ah = ua >> 16, al = (uint16_t)ua;
+                        uint16_t bh = ub >> 16, bl = (uint16_t)ub;
+                        uint32_t limit = neg ? 0x80000000UL : 0x7FFFFFFFUL;
+
+                        uint32_t hh = (uint32_t)ah * bh;
+                        if (hh >= 0x8000) return neg ? MINRAW : MAXRAW;
+                        uint32_t ll = (uint32_t)al * bl;
+                        uint32_t r = hh << 16;
+                        uint32_t t = (uint32_t)ah * bl;
+                        if ((r += t) < t) return neg ? MINRAW : MAXRAW;
+                        t = (uint32_t)al * bh;
+                        if ((r += t) < t) return neg ? MINRAW : MAXRAW;
+                        t = (ll >> 16) + ((neg && (ll & 0xFFFF)) ? 1 : 0);
+                        if ((r += t) < t) return neg ? MINRAW : MAXRAW;
+                        if (r > limit) return neg ? MINRAW : MAXRAW;
+                        return neg ? (T)(0 - r) : (T)r;
+                    }
+
+        /*
+         *  The whole part of the quotient comes from a 32 bit divide, and
+         *  its 16 fraction bits from shifting and subtracting the
+         *  remainder.
+         */
+
+        static T    div16(T a, T b)
+                    {
+                        bool neg = (a < 0) != (b < 0);
+                        uint32_t ua = (a < 0) ? -(uint32_t)a : (uint32_t)a;
+                        uint32_t ub = (b < 0) ? -(uint32_t)b : (uint32_t)b;
+                        uint32_t limit = neg ? 0x80000000UL : 0x7FFFFFFFUL;
+
+                        uint32_t q = ua / ub;
+                        uint32_t r = ua - q * ub;
+                        if (q > (limit >> 16)) return neg ? MINRAW : MAXRAW;
+                        for (uint8_t i = 0; i < 16; ++i) {
+                            q <<= 1;
+                            if (r >= 0x80000000UL) {
+                                r = (r << 1) - ub;      // wraps back below ub
+                                q |= 1;
+                            } else {
+                                r <<= 1;
+                                if (r >= ub) {
+                                    r -= ub;
+                                    q |= 1;
+                                }
+                            }
+                        }
+                        if (q > limit) return neg ? MINRAW : MAXRAW;
+                        return neg ? (T)(0 - q) : (T)q;
+                    }
+
+        static constexpr T fromFloat(float f)
+                    {
+                        return (f >= (float)MAXRAW / (float)ONE) ? MAXRAW :
+                               ((f <= (float)MINRAW / (float)ONE) ? MINRAW :
+                               (T)(f * (float)ONE + ((f < 0) ? -0.5f : 0.5f)));
+                    }
+};
+
+/*
+ *  Q16.16: range +/-32768, resolution 1/65536
+ *  Q8.8: range +/-128, resolution 1/256. Suitable only for small scenes
+ */
+
+typedef G3DFixedPoint<int32_t,int64_t,16> G3DFixed16;
+typedef G3DFixedPoint<int16_t,int32_t,8> G3DFixed8;
+
+#endif // _G3DFIXED_H
@@ -0,0 +1,22 @@
+/*  G3DFlash.h
+ *
+ *      Access to constant data stored in flash (PROGMEM). On the AVR
+ *  constant data must be explicitly placed in and read from program
+ *  memory; elsewhere these map to ordinary memory access.
+ */
+
+#ifndef _G3DFLASH_H
+#define _G3DFLASH_H
+
+#include <string.h>
+
+#if defined(ARDUINO)
+#include <avr/pgmspace.h>		// Non-AVR cores provide a compatible header
+#else
+#define PROGMEM
+#define memcpy_P(d,s,n)			memcpy(d,s,n)
+#define pgm_read_byte(p)		(*(const uint8_t *)(p))
+#define pgm_read_word(p)		(*(const uint16_t *)(p))
+#endif
+
+#endif // _G3DFLASH_H
@@ -0,0 +1,237 @@
+/*  G3DGovernor.cpp
+ *
+ *      Frame time governor
+ */
+
+#include "G3DGovernor.h"
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+
+/*
+ *	Quality is raised after this many frames in a row which took less
+ *	than G3D_GOVERNSPARE eighths of the budget; a frame over budget
+ *	lowers it at once, by two steps if it took half as long again.
+ */
+
+#define G3D_GOVERNCALM		16
+#define G3D_GOVERNSPARE		5
+
+/*
+ *	Weight of a new frame in the running cost per vertex or segment, as
+ *	a shift: 1/2 when it cost more, so we soon stop overrunning, and
+ *	1/8 when it cost less. Objects are coarsened to leave a reserve of
+ *	1/G3D_GOVERNRESERVE of the budget for the end of the frame.
+ */
+
+#define G3D_GOVERNUP		1
+#define G3D_GOVERNDOWN		3
+#define G3D_GOVERNRESERVE	8
+
+/*	Clock
+ *
+ *		Microseconds, from micros() on the device and steady_clock on the
+ *	desktop. Only differences are used, so wrapping does no harm.
+ */
+
+static inline uint32_t Clock()
+{
+#if defined(ARDUINO)
+    return micros();
+#else
+    return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Constructor														*/
+/*                                                                  */
+/********************************************************************/
+
+/*	G3DGovernor::G3DGovernor
+ *
+ *		Start at full detail, with a budget of one frame at the given
+ *	rate and no idea yet what anything costs. A rate of 0 is taken as
+ *	1 frame a second.
+ */
+
+G3DGovernor::G3DGovernor(uint16_t frameRate)
+{
+    if (frameRate == 0) frameRate = 1;
+    budget = 1000000UL / frameRate;
+    basePixels = 1;
+    frameStart = 0;
+    frameUnits = 0;
+    calm = 0;
+
+    state.change = G3D_GOVERNHOLD;
+    state.frameTime = 0;
+    state.predicted = 0;
+    state.unitCost = 0;
+    state.objects = 0;
+    state.skipped = 0;
+    state.coarsened = 0;
+    setQuality(G3D_QUALITYBEST);
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Quality															*/
+/*                                                                  */
+/********************************************************************/
+
+/*	G3DGovernor::setQuality
+ *
+ *		Set the knobs for a quality step. Each step doubles the pixel
+ *	error allowed for levels of detail or the spacing of points, in
+ *	turn, and from step 2 on objects of fewer than step - 1 pixels
+ *	radius are left out.
+ */
+
+void G3DGovernor::setQuality(uint8_t quality)
+{
+    if (quality > G3D_QUALITYWORST) quality = G3D_QUALITYWORST;
+
+    state.quality = quality;
+    state.lodPixels = basePixels * (1 << ((quality + 1) / 2));
+    state.pointStep = 1 << (quality / 2);
+    state.minRadius = (quality < 2) ? 0 : quality - 1;
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Frames															*/
+/*                                                                  */
+/********************************************************************/
+
+/*	G3DGovernor::beginFrame
+ *
+ *		Start timing a frame
+ */
+
+void G3DGovernor::beginFrame()
+{
+    frameUnits = 0;
+    state.objects = 0;
+    state.skipped = 0;
+    state.coarsened = 0;
+    frameStart = Clock();
+}
+
+/*	G3DGovernor::endFrame
+ *
+ *		Finish a frame: learn what its work cost, and move the quality
+ *	up or down for the next. Returns the time the frame took.
+ */
+
+uint32_t G3DGovernor::endFrame()
+{
+    uint32_t time = Clock() - frameStart;
+
+    state.frameTime = time;
+    state.predicted = (uint32_t)(frameUnits * state.unitCost);
+    if (frameUnits) {
+        float cost = (float)time / frameUnits;
+        if (state.unitCost == 0) {
+            state.unitCost = cost;
+        } else if (cost > state.unitCost) {
+            state.unitCost += (cost - state.unitCost) / (1 << G3D_GOVERNUP);
+        } else {
+            state.unitCost += (cost - state.unitCost) / (1 << G3D_GOVERNDOWN);
+        }
+    }
+
+    state.change = G3D_GOVERNHOLD;
+    if (time > budget) {
+        calm = 0;
+        if (state.quality < G3D_QUALITYWORST) {
+            setQuality(state.quality + ((time > budget + budget / 2) ? 2 : 1));
+            state.change = G3D_GOVERNLOWER;
+        }
+    } else if (time < budget / 8 * G3D_GOVERNSPARE) {
+        if (++calm >= G3D_GOVERNCALM) {
+            calm = 0;
+            if (state.quality > G3D_QUALITYBEST) {
+                setQuality(state.quality - 1);
+                state.change = G3D_GOVERNRAISE;
+            }
+        }
+    } else {
+        calm = 0;
+    }
+    return time;
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Drawing															*/
+/*                                                                  */
+/********************************************************************/
+
+/*	G3DGovernor::drawLODMesh
+ *
+ *		Draw a level of detail mesh at the current quality. A mesh
+ *	outside the view returns G3D_LODCULLED, and one whose bounding
+ *	sphere is smaller on screen than minRadius G3D_LODSKIPPED. If the
+ *	time spent so far plus the predicted cost of the level chosen would
+ *	eat into the reserve, coarser levels are tried until one fits or
+ *	none are left. Returns the level drawn; a mesh with no levels is
+ *	G3D_LODSKIPPED.
+ */
+
+uint8_t G3DGovernor::drawLODMesh(G3D &draw, const G3DLODMesh &mesh)
+{
+    if (mesh.levelCount == 0) return G3D_LODSKIPPED;
+
+    uint8_t cull = draw.cullSphere(mesh.x,mesh.y,mesh.z,mesh.radius);
+    if (cull == G3D_OUTSIDE) return G3D_LODCULLED;
+
+    uint8_t level = 0;
+    float scale = draw.pixelScale(mesh.x,mesh.y,mesh.z,mesh.radius);
+    if (scale > 0) {
+        if (G3DToFloat(mesh.radius) * scale < state.minRadius) {
+            ++state.skipped;
+            return G3D_LODSKIPPED;
+        }
+        float limit = state.lodPixels / scale;
+        level = mesh.levelCount - 1;
+        while ((level > 0) && (G3DToFloat(mesh.levels[level].error) > limit)) --level;
+    }
+
+    if (state.unitCost > 0) {
+        float left = (float)(budget - budget / G3D_GOVERNRESERVE) - (float)(Clock() - frameStart);
+        uint8_t fit = level;
+        while ((fit + 1 < mesh.levelCount) &&
+               ((mesh.levels[fit].vertexCount + mesh.levels[fit].edgeCount) * state.unitCost > left)) {
+            ++fit;
+        }
+        if (fit != level) {
+            ++state.coarsened;
+            level = fit;
+        }
+    }
+
+    draw.drawLODLevel(mesh,level,cull);
+    frameUnits += mesh.levels[level].vertexCount + mesh.levels[level].edgeCount;
+    ++state.objects;
+    return level;
+}
+
+/*	G3DGovernor::drawPoints
+ *
+ *		Draw every pointStep'th point of an array of x,y,z triplets
+ */
+
+void G3DGovernor::drawPoints(G3D &draw, uint16_t count, const G3DScalar *points)
+{
+    uint8_t step = state.pointStep;
+    for (uint16_t n = (count + step - 1) / step; n; --n) {
+        draw.point(points[0],points[1],points[2]);
+        ++frameUnits;
+        if (n > 1) points += 3 * step;
+    }
+}
@@ -0,0 +1,108 @@
+/*  G3DGovernor.h
+ *
+ *      Frame time governor. Times each frame's drawing against a budget,
+ *  and trades detail for speed to hold a frame rate: coarser levels of
+ *  detail, fewer points, and small objects left out, put back as time
+ *  allows.
+ */
+
+#ifndef _G3DGOVERNOR_H
+#define _G3DGOVERNOR_H
+
+#include <stdint.h>
+#include "G3D.h"
+
+/*
+ *	Quality steps, from G3D_QUALITYBEST (full detail) to G3D_QUALITYWORST
+ */
+
+#define G3D_QUALITYBEST		0
+#define G3D_QUALITYWORST	7
+
+/*
+ *	The change made at the end of a frame; see G3DGovernorState
+ */
+
+#define G3D_GOVERNHOLD		0	// quality unchanged
+#define G3D_GOVERNLOWER		1	// over budget: less detail
+#define G3D_GOVERNRAISE		2	// time to spare: more detail
+
+/********************************************************************/
+/*                                                                  */
+/*  G3DGovernor														*/
+/*                                                                  */
+/********************************************************************/
+
+/*  G3DGovernorState
+ *
+ *      The governor's settings for the current frame, and what happened
+ *  in the last one, for logging. Times are in microseconds.
+ */
+
+struct G3DGovernorState {
+	uint8_t quality;			// G3D_QUALITYBEST to G3D_QUALITYWORST
+	uint8_t change;				// G3D_GOVERNHOLD, LOWER or RAISE
+	float	lodPixels;			// pixel error for levels of detail
+	uint8_t pointStep;			// draw every pointStep'th point
+	float	minRadius;			// skip objects smaller than this, pixels
+
+	uint32_t frameTime;			// last frame: time taken
+	uint32_t predicted;			// last frame: time predicted
+	float	unitCost;			// time per vertex or segment
+	uint16_t objects;			// last frame: objects drawn
+	uint16_t skipped;			// last frame: objects too small to draw
+	uint16_t coarsened;			// last frame: objects drawn coarser to fit
+};
+
+/*  G3DGovernor
+ *
+ *      Call beginFrame before drawing and endFrame after, and draw level
+ *  of detail meshes and point sets through the governor; other drawing
+ *  can be counted with addWork. The cost of a frame is predicted as the
+ *  vertices and segments it holds times the measured cost of each, and
+ *  an object which would take the frame over budget is drawn at a
+ *  coarser level. At the end of each frame the quality is lowered if it
+ *  ran over, and raised again after several frames with time to spare.
+ */
+
+class G3DGovernor
+{
+    public:
+                G3DGovernor(uint16_t frameRate);
+
+        void    setBudget(uint32_t us)
+                    {
+                        budget = us;
+                    }
+        void    setPixels(float pixels)
+                    {
+                        basePixels = pixels;
+                        setQuality(state.quality);
+                    }
+        void    setQuality(uint8_t quality);
+
+        void    beginFrame();
+        uint32_t endFrame();
+
+        uint8_t drawLODMesh(G3D &draw, const G3DLODMesh &mesh);
+        void    drawPoints(G3D &draw, uint16_t count, const G3DScalar *points);
+        void    addWork(uint32_t vertices, uint32_t segments)
+                    {
+                        frameUnits += vertices + segments;
+                    }
+
+        const G3DGovernorState &getState() const
+                    {
+                        return state;
+                    }
+
+    private:
+        G3DGovernorState state;
+        uint32_t budget;
+        float   basePixels;
+        uint32_t frameStart;
+        uint32_t frameUnits;            // vertices and segments this frame
+        uint8_t calm;                   // frames in a row with time to spare
+};
+
+#endif // _G3DGOVERNOR_H
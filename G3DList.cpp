@@ -0,0 +1,64 @@
+/*  G3DList.cpp
+ *
+ *      Display list recording
+ */
+
+#include "G3DList.h"
+
+/********************************************************************/
+/*                                                                  */
+/*  Constructor														*/
+/*                                                                  */
+/********************************************************************/
+
+/*	G3DDisplayList::G3DDisplayList
+ *
+ *		Construct a recorder writing into o and v, which have room for
+ *	size commands; o also holds the end.
+ */
+
+G3DDisplayList::G3DDisplayList(uint8_t *o, G3DScalar *v, uint16_t s)
+{
+	ops = o;
+	vertices = v;
+	size = s;
+	clear();
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Recording														*/
+/*                                                                  */
+/********************************************************************/
+
+/*	G3DDisplayList::clear
+ *
+ *		Empty the list
+ */
+
+void G3DDisplayList::clear()
+{
+	count = 0;
+	overflowed = false;
+	setOp(0,G3D_LIST_END);
+}
+
+/*	G3DDisplayList::append
+ *
+ *		Append a command, keeping the list terminated
+ */
+
+void G3DDisplayList::append(uint8_t op, G3DScalar x, G3DScalar y, G3DScalar z)
+{
+	if (count >= size) {
+		overflowed = true;
+		return;
+	}
+
+	G3DScalar *v = vertices + 3 * count;
+	v[0] = x;
+	v[1] = y;
+	v[2] = z;
+	setOp(count++,op);
+	setOp(count,G3D_LIST_END);
+}
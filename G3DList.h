@@ -0,0 +1,115 @@
+/*  G3DList.h
+ *
+ *      Display lists: a recorded stream of move/draw/point commands which
+ *  can be replayed through the pipeline with the current transformation.
+ */
+
+#ifndef _G3DLIST_H
+#define _G3DLIST_H
+
+#include <stdint.h>
+#include "G3DMath.h"
+#include "G3DFlash.h"
+
+/********************************************************************/
+/*                                                                  */
+/*  List Entries													*/
+/*                                                                  */
+/********************************************************************/
+
+#define G3D_LIST_END		0
+#define G3D_LIST_MOVE		1
+#define G3D_LIST_DRAW		2
+#define G3D_LIST_POINT		3
+
+/*
+ *	A display list is held as two arrays: the opcodes, packed four to a
+ *	byte (the first in the low two bits) and ended by G3D_LIST_END, and
+ *	an x,y,z triplet of vertex data for each command. A command costs 3
+ *	scalars and 2 bits, against 3 scalars, an opcode and any padding
+ *	for an array of records. G3D_LIST_OPS packs four opcodes, so a
+ *	static list may be written directly in source and stored in flash:
+ *
+ *	    const uint8_t boxOps[] PROGMEM = {
+ *	        G3D_LIST_OPS(G3D_LIST_MOVE,G3D_LIST_DRAW,G3D_LIST_DRAW,G3D_LIST_DRAW),
+ *	        ...
+ *	        G3D_LIST_OPS(G3D_LIST_END,0,0,0)
+ *	    };
+ *	    const G3DScalar boxVertices[] PROGMEM = {
+ *	        -1, -1, -1,   1, -1, -1,   1,  1, -1,  -1,  1, -1,
+ *	        ...
+ *	    };
+ *
+ *	G3D_LIST_OPBYTES gives the opcode bytes for n commands and the end.
+ */
+
+#define G3D_LIST_OPS(a,b,c,d)	((a) | ((b) << 2) | ((c) << 4) | ((d) << 6))
+#define G3D_LIST_OPBYTES(n)		(((n) + 4) / 4)
+
+/********************************************************************/
+/*                                                                  */
+/*  Display List Recorder											*/
+/*                                                                  */
+/********************************************************************/
+
+/*  G3DDisplayList
+ *
+ *      Records move/draw/point calls into caller provided opcode and
+ *  vertex arrays, with room for size commands: G3D_LIST_OPBYTES(size)
+ *  opcode bytes and 3 * size scalars. The list is always kept ended, so
+ *  it may be replayed at any time with G3D::drawList. Commands which do
+ *  not fit are dropped and the list is marked as overflowed.
+ */
+
+class G3DDisplayList
+{
+    public:
+                G3DDisplayList(uint8_t *ops, G3DScalar *vertices, uint16_t size);
+
+        void    clear();
+        void    move(G3DScalar x, G3DScalar y, G3DScalar z)
+                    {
+                        append(G3D_LIST_MOVE,x,y,z);
+                    }
+        void    draw(G3DScalar x, G3DScalar y, G3DScalar z)
+                    {
+                        append(G3D_LIST_DRAW,x,y,z);
+                    }
+        void    point(G3DScalar x, G3DScalar y, G3DScalar z)
+                    {
+                        append(G3D_LIST_POINT,x,y,z);
+                    }
+
+        const uint8_t *opcodes() const
+                    {
+                        return ops;
+                    }
+        const G3DScalar *vertexData() const
+                    {
+                        return vertices;
+                    }
+        uint16_t length() const
+                    {
+                        return count;
+                    }
+        bool    overflow() const
+                    {
+                        return overflowed;
+                    }
+
+    private:
+        uint8_t *ops;
+        G3DScalar *vertices;
+        uint16_t size;
+        uint16_t count;
+        bool    overflowed;
+
+        void    append(uint8_t op, G3DScalar x, G3DScalar y, G3DScalar z);
+        void    setOp(uint16_t index, uint8_t op)
+                    {
+                        uint8_t shift = (index & 3) * 2;
+                        ops[index >> 2] = (ops[index >> 2] & ~(3 << shift)) | (op << shift);
+                    }
+};
+
+#endif // _G3DLIST_H
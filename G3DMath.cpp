@@ -6,6 +6,7 @@
 #include <math.h>
 #include <stdint.h>
 #include "G3DMath.h"
+#include "G3DFlash.h"
 
 /************************************************************************/
 /*                                                                      */
@@ -23,6 +24,144 @@ G3DMatrix::G3DMatrix()
     setIdentity();
 }
 
+/************************************************************************/
+/*                                                                      */
+/*  Trigonometry                                                        */
+/*                                                                      */
+/************************************************************************/
+
+#if G3DTRIG == G3D_TRIG_TABLE
+
+/*  SineTable
+ *
+ *      A quarter wave of sine, 0 to 90 degrees in 64 steps, scaled so
+ *  that 1.0 is 65535.
+ */
+
+static const uint16_t SineTable[65] PROGMEM = {
+        0,  1608,  3216,  4821,  6424,  8022,  9616, 11204,
+    12785, 14359, 15924, 17479, 19024, 20557, 22078, 23586,
+    25079, 26557, 28020, 29465, 30893, 32302, 33692, 35061,
+    36409, 37736, 39039, 40319, 41575, 42806, 44011, 45189,
+    46340, 47464, 48558, 49624, 50659, 51664, 52638, 53580,
+    54490, 55367, 56211, 57021, 57797, 58537, 59243, 59913,
+    60546, 61144, 61704, 62227, 62713, 63161, 63571, 63943,
+    64276, 64570, 64826, 65042, 65219, 65357, 65456, 65515,
+    65535
+};
+
+/*  SinFine
+ *
+ *      Sine of a fine angle (65536 to a circle) as a 16.16 fixed point
+ *  value. We fold the angle into the first quadrant, then linearly
+ *  interpolate between table entries, 256 fine units apart.
+ */
+
+static int32_t SinFine(uint16_t angle)
+{
+    bool negate = (angle & 0x8000) != 0;
+    uint16_t q = angle & 0x3FFF;
+    if (angle & 0x4000) q = 0x4000 - q;
+
+    uint8_t index = q >> 8;
+    uint8_t frac = q & 0xFF;
+    int32_t v = pgm_read_word(SineTable + index);
+    if (frac) {
+        int32_t n = pgm_read_word(SineTable + index + 1);
+        v += ((n - v) * frac) >> 8;
+    }
+
+    v += v >> 15;                   // Rescale so 65535 becomes 1.0 (65536)
+    return negate ? -v : v;
+}
+
+/*  FromFixed16
+ *
+ *      Convert a 16.16 fixed point value to our scalar
+ */
+
+static inline G3DScalar FromFixed16(int32_t v)
+{
+#if G3DSCALAR == G3D_FIXED16
+    return G3DScalar::raw(v);
+#elif G3DSCALAR == G3D_FIXED8
+    return G3DScalar::raw((int16_t)((v + 0x80) >> 8));
+#else
+    return v * (1.0f / 65536.0f);
+#endif
+}
+
+/*  FineAngle
+ *
+ *      Convert an angle in radians to a fine angle, 65536 to a circle.
+ *  Angles outside of 0 to 2pi wrap around.
+ */
+
+static inline uint16_t FineAngle(G3DScalar angle)
+{
+#if G3DSCALAR == G3D_FIXED16
+    // 65536 / 2pi in 16.16 fixed point (10430 + 24796/65536), times the
+    // whole and fraction halves of our 16.16 angle, in 32 bits
+    int32_t whole = angle.v >> 16;
+    uint32_t frac = (uint16_t)angle.v;
+    int32_t mid = whole * 24796 + (int32_t)(frac * 10430) + (int32_t)((frac * 24796) >> 16);
+    return (uint16_t)(whole * 10430 + (mid >> 16));
+#elif G3DSCALAR == G3D_FIXED8
+    // 65536 / 2pi in 24.8 fixed point, times our 8.8 angle
+    return (uint16_t)(((int32_t)angle.v * 10430) >> 8);
+#else
+    return (uint16_t)(int32_t)(angle * 10430.378f);
+#endif
+}
+
+#endif
+
+/*  Sin, Cos
+ *
+ *      Sine and cosine of an angle in radians
+ */
+
+static inline G3DScalar Sin(G3DScalar angle)
+{
+#if G3DTRIG == G3D_TRIG_TABLE
+    return FromFixed16(SinFine(FineAngle(angle)));
+#else
+    return (G3DScalar)sin(G3DToFloat(angle));
+#endif
+}
+
+static inline G3DScalar Cos(G3DScalar angle)
+{
+#if G3DTRIG == G3D_TRIG_TABLE
+    return FromFixed16(SinFine(FineAngle(angle) + 0x4000));
+#else
+    return (G3DScalar)cos(G3DToFloat(angle));
+#endif
+}
+
+/*  SinAngle, CosAngle
+ *
+ *      Sine and cosine of an angle in binary angle units
+ */
+
+static inline G3DScalar SinAngle(G3DAngle angle)
+{
+#if G3DTRIG == G3D_TRIG_TABLE
+    return FromFixed16(SinFine(angle << 6));
+#else
+    return (G3DScalar)sin((angle % G3D_ANGLE_FULL) * (float)(2 * M_PI / G3D_ANGLE_FULL));
+#endif
+}
+
+static inline G3DScalar CosAngle(G3DAngle angle)
+{
+#if G3DTRIG == G3D_TRIG_TABLE
+    return FromFixed16(SinFine((angle << 6) + 0x4000));
+#else
+    return (G3DScalar)cos((angle % G3D_ANGLE_FULL) * (float)(2 * M_PI / G3D_ANGLE_FULL));
+#endif
+}
+
 /************************************************************************/
 /*                                                                      */
 /*  Matrix Creation                                                     */
@@ -38,7 +177,7 @@ void G3DMatrix::setIdentity()
 {
     for (uint8_t i = 0; i < 4; ++i) {
         for (uint8_t j = 0; j < 4; ++j) {
-            a[i][j] = (i == j) ? 1.0f : 0.0f;
+            a[i][j] = (i == j) ? G3DScalar(1) : G3DScalar(0);
         }
     }
 }
@@ -48,7 +187,7 @@ void G3DMatrix::setIdentity()
  *      Create a translation matrix
  */
 
-void G3DMatrix::setTranslate(float x, float y, float z)
+void G3DMatrix::setTranslate(G3DScalar x, G3DScalar y, G3DScalar z)
 {
     setIdentity();
     a[0][3] = x;
@@ -61,7 +200,7 @@ void G3DMatrix::setTranslate(float x, float y, float z)
  *      Scale matrix
  */
 
-void G3DMatrix::setScale(float x, float y, float z)
+void G3DMatrix::setScale(G3DScalar x, G3DScalar y, G3DScalar z)
 {
     setIdentity();
     a[0][0] = x;
@@ -74,7 +213,7 @@ void G3DMatrix::setScale(float x, float y, float z)
  *      Scale matrix
  */
 
-void G3DMatrix::setScale(float s)
+void G3DMatrix::setScale(G3DScalar s)
 {
     setIdentity();
     a[0][0] = s;
@@ -84,14 +223,23 @@ void G3DMatrix::setScale(float s)
 
 /*  G3DMatrix::setRotate
  *   
- *      Rotational matrix. Axis is 0 (x), 1 (y) or 2 (z)
+ *      Rotational matrix. Axis is 0 (x), 1 (y) or 2 (z). The angle is
+ *  in radians, or in binary angle units for setRotateAngle.
  */
 
-void G3DMatrix::setRotate(uint8_t axis, float angle)
+void G3DMatrix::setRotate(uint8_t axis, G3DScalar angle)
+{
+    setRotate(axis,Cos(angle),Sin(angle));
+}
+
+void G3DMatrix::setRotateAngle(uint8_t axis, G3DAngle angle)
+{
+    setRotate(axis,CosAngle(angle),SinAngle(angle));
+}
+
+void G3DMatrix::setRotate(uint8_t axis, G3DScalar c, G3DScalar s)
 {
     setIdentity();
-    float c = cos(angle);
-    float s = sin(angle);
     
     switch (axis) {
         case AXIS_X:
@@ -122,15 +270,15 @@ void G3DMatrix::setRotate(uint8_t axis, float angle)
  *      Set the perspective matrix. See https://github.com/w3woody/clipping
  */
 
-void G3DMatrix::setPerspective(float fov, float near)
+void G3DMatrix::setPerspective(G3DScalar fov, G3DScalar near)
 {
     setIdentity();
 
     a[0][0] = fov;
     a[1][1] = fov;
-    a[2][2] = 0.0f;
-    a[3][3] = 0.0f;
-    a[2][3] = -1.0f;
+    a[2][2] = 0;
+    a[3][3] = 0;
+    a[2][3] = -1;
     a[3][2] = -near;
 }
 
@@ -148,20 +296,42 @@ void G3DMatrix::setPerspective(float fov, float near)
  *  is done implies you must start with the last (perspective) matrix first,
  *  pushing earlier transformations later. This allows you (if you wish)
  *  to build a push stack of matrices, though in the limited confines of
- *  an embedded processor that stack cannot be very large...
+ *  an embedded processor that stack cannot be very large... (See G3D::push
+ *  and G3D_STACKDEPTH.)
  */
 
 void G3DMatrix::multiply(const G3DMatrix &m)
 {
-    float tmp[4];
-    float n;
+    G3DScalar tmp[4];
+    G3DScalar n;
+
+    /*
+     *  If m is affine its bottom row is (0,0,0,1), so we can skip those
+     *  terms. If we are also affine, our bottom row is unchanged.
+     */
+
+    if (m.isAffine()) {
+        uint8_t rows = isAffine() ? 3 : 4;
+        for (uint8_t i = 0; i < rows; ++i) {
+            for (uint8_t j = 0; j < 4; ++j) {
+                n = a[i][0] * m.a[0][j] + a[i][1] * m.a[1][j] + a[i][2] * m.a[2][j];
+                if (j == 3) n += a[i][3];
+                tmp[j] = n;
+            }
+
+            for (uint8_t j = 0; j < 4; ++j) {
+                a[i][j] = tmp[j];
+            }
+        }
+        return;
+    }
     
     for (uint8_t i = 0; i < 4; ++i) {
         /*
          * Comlumn by column multiply and replace.
          */
         for (uint8_t j = 0; j < 4; ++j) {
-            n = 0.0f;
+            n = 0;
             for (uint8_t k = 0; k < 4; ++k) {
                 n += m.a[k][j] * a[i][k];
             }
@@ -174,6 +344,86 @@ void G3DMatrix::multiply(const G3DMatrix &m)
     }
 }
 
+/*  G3DMatrix::translate
+ *
+ *      Multiply by a translation matrix. This only changes the last
+ *  column: each row gains x, y and z times its first three columns.
+ */
+
+void G3DMatrix::translate(G3DScalar x, G3DScalar y, G3DScalar z)
+{
+    for (uint8_t i = 0; i < 4; ++i) {
+        a[i][3] = a[i][0] * x + a[i][1] * y + a[i][2] * z + a[i][3];
+    }
+}
+
+/*  G3DMatrix::scale
+ *
+ *      Multiply by a scale matrix. This scales the first three columns.
+ */
+
+void G3DMatrix::scale(G3DScalar x, G3DScalar y, G3DScalar z)
+{
+    for (uint8_t i = 0; i < 4; ++i) {
+        a[i][0] *= x;
+        a[i][1] *= y;
+        a[i][2] *= z;
+    }
+}
+
+void G3DMatrix::scale(G3DScalar s)
+{
+    scale(s,s,s);
+}
+
+/*  G3DMatrix::rotate
+ *
+ *      Multiply by a rotation matrix (as built by setRotate). This only
+ *  changes the two columns for the axes perpendicular to our axis. The
+ *  angle is in radians, or in binary angle units for rotateAngle.
+ */
+
+void G3DMatrix::rotate(uint8_t axis, G3DScalar angle)
+{
+    rotate(axis,Cos(angle),Sin(angle));
+}
+
+void G3DMatrix::rotateAngle(uint8_t axis, G3DAngle angle)
+{
+    rotate(axis,CosAngle(angle),SinAngle(angle));
+}
+
+void G3DMatrix::rotate(uint8_t axis, G3DScalar c, G3DScalar s)
+{
+    uint8_t p,q;
+
+    switch (axis) {
+        case AXIS_X:
+            p = 1;
+            q = 2;
+            break;
+        case AXIS_Y:
+            // Note the order: rotating about y turns z towards x
+            p = 2;
+            q = 0;
+            break;
+        case AXIS_Z:
+            p = 0;
+            q = 1;
+            s = -s;
+            break;
+        default:
+            return;
+    }
+
+    for (uint8_t i = 0; i < 4; ++i) {
+        G3DScalar ap = a[i][p];
+        G3DScalar aq = a[i][q];
+        a[i][p] = ap * c + aq * s;
+        a[i][q] = ap * (-s) + aq * c;
+    }
+}
+
 /************************************************************************/
 /*                                                                      */
 /*  Vector multiplication                                               */
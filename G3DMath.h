@@ -6,6 +6,99 @@
 #ifndef _G3DMATH_H
 #define _G3DMATH_H
 
+#include <stdint.h>
+#include "G3DFixed.h"
+
+/************************************************************************/
+/*                                                                      */
+/*  Scalar Type                                                         */
+/*                                                                      */
+/************************************************************************/
+
+/*
+ *  G3DSCALAR selects the arithmetic used by the matrix routines and the
+ *  pipeline. Float is the most accurate; the fixed point types avoid the
+ *  soft-float library on processors without an FPU.
+ */
+
+#define G3D_FLOAT       0               // 32-bit float
+#define G3D_FIXED16     1               // Q16.16 fixed point
+#define G3D_FIXED8      2               // Q8.8 fixed point
+
+#ifndef G3DSCALAR
+#define G3DSCALAR       G3D_FLOAT
+#endif
+
+#if G3DSCALAR == G3D_FIXED16
+typedef G3DFixed16 G3DScalar;
+#elif G3DSCALAR == G3D_FIXED8
+typedef G3DFixed8 G3DScalar;
+#else
+typedef float G3DScalar;
+#endif
+
+/*  G3DToInt, G3DToFloat
+ *
+ *      Convert a scalar to an integer (truncating) or a float, regardless
+ *  of the representation.
+ */
+
+#if G3DSCALAR == G3D_FLOAT
+inline int16_t G3DToInt(float f)
+{
+    return (int16_t)f;
+}
+
+inline float G3DToFloat(float f)
+{
+    return f;
+}
+#else
+inline int16_t G3DToInt(G3DScalar f)
+{
+    return f.toInt();
+}
+
+inline float G3DToFloat(G3DScalar f)
+{
+    return f.toFloat();
+}
+#endif
+
+/************************************************************************/
+/*                                                                      */
+/*  Angles                                                              */
+/*                                                                      */
+/************************************************************************/
+
+/*
+ *  G3DTRIG selects how sine and cosine are calculated for rotations.
+ *  G3D_TRIG_LIBM uses the C library; G3D_TRIG_TABLE interpolates a
+ *  quarter-wave table in flash, which is far cheaper without an FPU.
+ *  The fixed point scalars default to the table, so that they need no
+ *  float at all.
+ */
+
+#define G3D_TRIG_LIBM   0
+#define G3D_TRIG_TABLE  1
+
+#ifndef G3DTRIG
+#if G3DSCALAR == G3D_FLOAT
+#define G3DTRIG         G3D_TRIG_LIBM
+#else
+#define G3DTRIG         G3D_TRIG_TABLE
+#endif
+#endif
+
+/*
+ *  Integer angles are given in binary angle units: G3D_ANGLE_FULL units
+ *  to a full circle, so 256 is 90 degrees.
+ */
+
+#define G3D_ANGLE_FULL  1024
+
+typedef uint16_t G3DAngle;
+
 /************************************************************************/
 /*                                                                      */
 /*  Matrix Structures                                                   */
@@ -29,17 +122,35 @@ class G3DMatrix
 
         // Initialize matrix
         void            setIdentity();
-        void            setTranslate(float x, float y, float z);
-        void            setScale(float x, float y, float z);
-        void            setScale(float x);
-        void            setRotate(uint8_t axis, float angle);
-        void            setPerspective(float fov, float near);
+        void            setTranslate(G3DScalar x, G3DScalar y, G3DScalar z);
+        void            setScale(G3DScalar x, G3DScalar y, G3DScalar z);
+        void            setScale(G3DScalar x);
+        void            setRotate(uint8_t axis, G3DScalar angle);
+        void            setRotateAngle(uint8_t axis, G3DAngle angle);
+        void            setPerspective(G3DScalar fov, G3DScalar near);
 
         // Inline multiply transformation matrix
         void            multiply(const G3DMatrix &m);
+
+        // Inline multiply by a specific transformation
+        void            translate(G3DScalar x, G3DScalar y, G3DScalar z);
+        void            scale(G3DScalar x, G3DScalar y, G3DScalar z);
+        void            scale(G3DScalar s);
+        void            rotate(uint8_t axis, G3DScalar angle);
+        void            rotateAngle(uint8_t axis, G3DAngle angle);
+
+        // Test if the bottom row is (0,0,0,1)
+        bool            isAffine() const
+                            {
+                                return (a[3][0] == 0) && (a[3][1] == 0) && (a[3][2] == 0) && (a[3][3] == 1);
+                            }
         
         // Raw contents of the matrix
-        float           a[4][4];
+        G3DScalar       a[4][4];
+
+    private:
+        void            setRotate(uint8_t axis, G3DScalar c, G3DScalar s);
+        void            rotate(uint8_t axis, G3DScalar c, G3DScalar s);
 };
 
 /*	G3DVector
@@ -48,10 +159,10 @@ class G3DMatrix
  */
 
 struct G3DVector {
-	float x;
-	float y;
-	float z;
-	float w;
+	G3DScalar x;
+	G3DScalar y;
+	G3DScalar z;
+	G3DScalar w;
 
     // Math support
     void                multiply(const G3DMatrix &m, const G3DVector &v);
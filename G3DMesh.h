@@ -0,0 +1,133 @@
+/*  G3DMesh.h
+ *
+ *      Indexed wireframe meshes
+ */
+
+#ifndef _G3DMESH_H
+#define _G3DMESH_H
+
+#include <stdint.h>
+#include "G3DMath.h"
+
+/********************************************************************/
+/*                                                                  */
+/*  Mesh Structures													*/
+/*                                                                  */
+/********************************************************************/
+
+/*  G3DMesh
+ *
+ *      An indexed wireframe mesh. Vertices are stored as x,y,z triplets;
+ *  edges are stored as pairs of indexes into the vertex array. Edges
+ *  which continue from the end of the previous edge are drawn without
+ *  lifting the pen, so ordering edges as connected runs is cheaper.
+ */
+
+struct G3DMesh {
+	uint16_t vertexCount;
+	uint16_t edgeCount;
+	const G3DScalar *vertices;		// 3 * vertexCount
+	const uint16_t *edges;			// 2 * edgeCount
+};
+
+/*  G3DMeshVertex
+ *
+ *      A transformed mesh vertex and its clipping outcode. The caller
+ *  provides an array of these to G3D::setMeshBuffer as scratch space.
+ */
+
+struct G3DMeshVertex {
+	G3DVector v;
+	uint8_t outcode;
+};
+
+/*  G3DSolidMesh
+ *
+ *      A wireframe mesh of a solid, which also knows its faces so edges
+ *  which are only on faces turned away from the viewer can be skipped.
+ *  Each face is given by three of its vertices, counter-clockwise when
+ *  seen from outside the solid. Each edge lists the face on either side
+ *  of it, or G3D_NOFACE; an edge with no faces is always drawn.
+ */
+
+#define G3D_NOFACE		0xFFFF
+
+struct G3DSolidMesh {
+	uint16_t vertexCount;
+	uint16_t edgeCount;
+	uint16_t faceCount;
+	const G3DScalar *vertices;		// 3 * vertexCount
+	const uint16_t *edges;			// 2 * edgeCount
+	const uint16_t *edgeFaces;		// 2 * edgeCount
+	const uint16_t *faces;			// 3 * faceCount
+};
+
+/*  G3DLODMesh
+ *
+ *      A mesh with several levels of detail, finest first, for
+ *  G3D::drawLODMesh. The levels share one vertex array; each coarser
+ *  level uses fewer of them, from the start of the array, so only
+ *  those need be transformed. Each level gives its error: the furthest
+ *  any vertex of the full mesh was moved to make it, in model units.
+ *  The bounding sphere holds every vertex.
+ *
+ *  host/g3dlod.cpp builds these from OBJ files and edge lists.
+ */
+
+struct G3DLODLevel {
+	uint16_t vertexCount;			// first vertexCount vertices
+	uint16_t edgeCount;
+	const uint16_t *edges;			// 2 * edgeCount
+	G3DScalar error;
+};
+
+#define G3D_LODCULLED	0xFF		// drawLODMesh: outside the view
+#define G3D_LODSKIPPED	0xFE		// too small to draw, or no levels
+
+struct G3DLODMesh {
+	uint8_t levelCount;
+	const G3DLODLevel *levels;		// levelCount, finest first
+	const G3DScalar *vertices;		// 3 * levels[0].vertexCount
+	G3DScalar x;					// bounding sphere
+	G3DScalar y;
+	G3DScalar z;
+	G3DScalar radius;
+};
+
+/********************************************************************/
+/*                                                                  */
+/*  Compact Meshes													*/
+/*                                                                  */
+/********************************************************************/
+
+/*
+ *	A compact mesh is a byte stream which can be stored in flash
+ *	(PROGMEM) or mapped straight from a file, and drawn with
+ *	G3D::drawCompactMesh or G3D::drawCompactMesh_P, which are given
+ *	its length in bytes and check it is all there. Vertices are
+ *	quantized to int8 or int16 and multiplied by a per-mesh scale;
+ *	edges are stored as strips of connected vertices. All multi-byte
+ *	values are little endian:
+ *
+ *		0	'G' '3' 'M' G3D_COMPACT_VERSION
+ *		4	flags (G3D_COMPACT_WORD, G3D_COMPACT_WIDEINDEX)
+ *		5	0
+ *		6	vertex count (uint16)
+ *		8	strip count (uint16)
+ *		10	0 (uint16)
+ *		12	scale (IEEE float)
+ *		16	vertices: x,y,z triplets of int8, or int16 if G3D_COMPACT_WORD
+ *			strips: a uint16 count followed by that many vertex indexes,
+ *			uint8 or uint16 if G3D_COMPACT_WIDEINDEX. A strip of one
+ *			vertex is drawn as a point.
+ *
+ *	host/g3dmesh.cpp converts OBJ files and edge lists to this format.
+ */
+
+#define G3D_COMPACT_VERSION		1
+#define G3D_COMPACT_HEADER		16
+
+#define G3D_COMPACT_WORD		0x01	// int16 coordinates
+#define G3D_COMPACT_WIDEINDEX	0x02	// uint16 vertex indexes
+
+#endif // _G3DMESH_H
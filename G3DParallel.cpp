@@ -0,0 +1,441 @@
+/*  G3DParallel.cpp
+ *
+ *      Multithreaded batch drawing
+ */
+
+#include "G3DParallel.h"
+
+#if G3D_PARALLEL
+
+/*
+ *	Batches with fewer vertices or edges than this are not worth waking
+ *	the pool for, and are drawn on the calling thread.
+ */
+
+#define G3D_PARALLELMIN		4096
+
+/*
+ *	Vertex chunks are a multiple of this, so each chunk splits between
+ *	the vector and scalar loops of G3DBatchTransform exactly as the whole
+ *	batch does.
+ */
+
+#define G3D_VERTEXCHUNK		64
+
+/********************************************************************/
+/*                                                                  */
+/*  Constructor/Destructor											*/
+/*                                                                  */
+/********************************************************************/
+
+/*	G3DParallel::G3DParallel
+ *
+ *		Start the pool. The calling thread does its share of each batch,
+ *	so we start one thread fewer than asked for.
+ */
+
+G3DParallel::G3DParallel(uint8_t threads)
+{
+    generation = 0;
+    running = 0;
+    quit = false;
+    task = NULL;
+    taskCount = 0;
+    nextTask = 0;
+
+    if (threads == 0) {
+        unsigned n = std::thread::hardware_concurrency();
+        threads = (n == 0) ? 1 : (n > 255) ? 255 : (uint8_t)n;
+    }
+    for (uint8_t i = 1; i < threads; ++i) {
+        pool.push_back(std::thread(&G3DParallel::worker,this));
+    }
+}
+
+G3DParallel::~G3DParallel()
+{
+    {
+        std::lock_guard<std::mutex> l(lock);
+        quit = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < pool.size(); ++i) pool[i].join();
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Thread Pool														*/
+/*                                                                  */
+/********************************************************************/
+
+/*	G3DParallel::worker
+ *
+ *		Each pool thread waits for a run, takes tasks until there are
+ *	none left, and reports that it is done.
+ */
+
+void G3DParallel::worker()
+{
+    uint32_t seen = 0;
+
+    for (;;) {
+        Task t;
+        uint32_t count;
+        {
+            std::unique_lock<std::mutex> l(lock);
+            while (!quit && (generation == seen)) wake.wait(l);
+            if (quit) return;
+            seen = generation;
+            t = task;
+            count = taskCount;
+        }
+
+        for (uint32_t i; (i = nextTask++) < count; ) (this->*t)(i);
+
+        std::lock_guard<std::mutex> l(lock);
+        if (--running == 0) idle.notify_one();
+    }
+}
+
+/*	G3DParallel::run
+ *
+ *		Run tasks 0 through count-1 on the pool and this thread. Every
+ *	pool thread checks in before we return, so the next run cannot be
+ *	confused with this one.
+ */
+
+void G3DParallel::run(Task t, uint32_t count)
+{
+    {
+        std::lock_guard<std::mutex> l(lock);
+        task = t;
+        taskCount = count;
+        nextTask = 0;
+        running = (uint32_t)pool.size();
+        ++generation;
+    }
+    wake.notify_all();
+
+    for (uint32_t i; (i = nextTask++) < count; ) (this->*t)(i);
+
+    std::unique_lock<std::mutex> l(lock);
+    while (running > 0) idle.wait(l);
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Transformation													*/
+/*                                                                  */
+/********************************************************************/
+
+/*	G3DParallel::transformBatch
+ *
+ *		The same as draw.transformBatch(x,y,z,out)
+ */
+
+void G3DParallel::transformBatch(G3D &draw, const G3DScalar *x, const G3DScalar *y, const G3DScalar *z, G3DBatch &out)
+{
+    if (pool.empty() || (out.count < G3D_PARALLELMIN)) {
+        draw.transformBatch(x,y,z,out);
+        return;
+    }
+
+#if G3D_STATS > 0
+    draw.stats.vertices += out.count;
+#endif
+
+    target = &draw;
+    srcX = x;
+    srcY = y;
+    srcZ = z;
+    outBatch = &out;
+
+    // A few chunks per thread so a slow thread does not hold up the rest
+    uint32_t n = threadCount() * 4;
+    chunkSize = (out.count + n - 1) / n;
+    chunkSize = (chunkSize + G3D_VERTEXCHUNK - 1) & ~(uint32_t)(G3D_VERTEXCHUNK - 1);
+    run(&G3DParallel::transformTask,(out.count + chunkSize - 1) / chunkSize);
+}
+
+void G3DParallel::transformTask(uint32_t index)
+{
+    uint32_t start = index * chunkSize;
+    G3DBatch chunk;
+    chunk.count = outBatch->count - start;
+    if (chunk.count > chunkSize) chunk.count = chunkSize;
+    chunk.x = outBatch->x + start;
+    chunk.y = outBatch->y + start;
+    chunk.z = outBatch->z + start;
+    chunk.w = outBatch->w + start;
+    chunk.outcode = outBatch->outcode + start;
+
+    G3DBatchTransform(target->transformation,srcX + start,srcY + start,srcZ + start,chunk);
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Drawing															*/
+/*                                                                  */
+/********************************************************************/
+
+/*	G3DParallel::drawBatch
+ *
+ *		The same as draw.drawBatch(batch,edgeCount,edges). Segments are
+ *	clipped chunk by chunk and then drawn strip by strip, as described
+ *	in G3DParallel.h; the rest (damage, dirty blocks, statistics and
+ *	the pen) is done here, in order, once the pool is finished.
+ */
+
+void G3DParallel::drawBatch(G3D &draw, const G3DBatch &batch, uint32_t edgeCount, const uint32_t *edges)
+{
+    if (pool.empty() || (edgeCount < G3D_PARALLELMIN)) {
+        draw.drawBatch(batch,edgeCount,edges);
+        return;
+    }
+
+    // Anything already pending goes first, as it would have anyway
+    draw.p1flush();
+
+    target = &draw;
+    inBatch = &batch;
+    edgeList = edges;
+
+    /*
+     *	Stages 3 and 2. Each edge makes at most one segment, so chunk i
+     *	records its segments from segments[chunks[i].first] on.
+     */
+
+    uint32_t n = threadCount() * 8;
+    chunkSize = (edgeCount + n - 1) / n;
+    if (chunkSize < 1024) chunkSize = 1024;
+    n = (edgeCount + chunkSize - 1) / chunkSize;
+
+    chunks.resize(n);
+    if (segments.size() < edgeCount) segments.resize(edgeCount);
+    for (uint32_t i = 0; i < n; ++i) {
+        chunks[i].first = i * chunkSize;
+        chunks[i].edges = (i + 1 < n) ? chunkSize : edgeCount - i * chunkSize;
+    }
+    run(&G3DParallel::clipTask,n);
+
+    /*
+     *	Stage 1, in strips of whole pages. Two strips per thread evens
+     *	out scenes which are busier at the top or bottom.
+     */
+
+    G3DFrameBuffer &lib = draw.lib;
+    uint16_t top = draw.yoffset;
+    uint16_t bottom = draw.yoffset + draw.height;
+    if (bottom > lib.height()) bottom = lib.height();
+
+    if (top < bottom) {
+        stripBase = top & ~7;
+        uint16_t pages = (bottom - stripBase + 7) >> 3;
+        uint16_t strips = threadCount() * 2;
+        if (strips > pages) strips = pages;
+        stripRows = ((pages + strips - 1) / strips) << 3;
+        strips = (bottom - stripBase + stripRows - 1) / stripRows;
+
+#if G3D_STATS > 0
+        stripPixels.assign(strips,0);
+#endif
+        run(&G3DParallel::rasterTask,strips);
+#if G3D_STATS > 0
+        for (uint16_t i = 0; i < strips; ++i) draw.stats.pixels += stripPixels[i];
+#endif
+    }
+
+    /*
+     *	Everything which is order dependent, or shared
+     */
+
+    uint16_t left = 0xFFFF;
+    uint16_t right = 0;
+    top = 0xFFFF;
+    bottom = 0;
+
+    for (uint32_t i = 0; i < n; ++i) {
+        const Chunk &c = chunks[i];
+
+        if (c.segments) {
+            if (c.left < left) left = c.left;
+            if (c.right > right) right = c.right;
+            if (c.top < top) top = c.top;
+            if (c.bottom > bottom) bottom = c.bottom;
+        }
+        if (draw.damage) {
+            for (uint32_t j = 0; j < c.segments; ++j) {
+                const G3DSegment &seg = segments[c.first + j];
+                draw.p1damage(seg.x1,seg.y1,seg.x2,seg.y2);
+            }
+        }
+        if (c.p3used) {
+            draw.p3pos = c.pos;
+            draw.p3outcode = c.outcode;
+        }
+        if (c.p1used) {
+            draw.p1draw = c.pen;
+            draw.p1x = c.x;
+            draw.p1y = c.y;
+        }
+
+#if G3D_STATS > 0
+        G3DStats &s = draw.stats;
+        s.accepted += c.stats.accepted;
+        s.rejected += c.stats.rejected;
+        s.clipped += c.stats.clipped;
+        s.guardBand += c.stats.guardBand;
+        s.divisions += c.stats.divisions;
+        s.lines += c.stats.lines;
+#endif
+    }
+
+    if (left <= right) {
+        lib.markRect(draw.xoffset + left,draw.yoffset + top,right - left + 1,bottom - top + 1);
+    }
+}
+
+/*	G3DParallel::clipTask
+ *
+ *		Run one chunk of edges through a private pipeline set up like
+ *	the target, recording the segments it would draw. We set the state
+ *	stage 3 and stage 1 leave behind to values they never hold, to see
+ *	if the chunk reached them.
+ */
+
+void G3DParallel::clipTask(uint32_t index)
+{
+    Chunk &c = chunks[index];
+
+    G3D w(target->lib,target->xoffset,target->yoffset,target->width,target->height);
+    w.p3clip = target->p3clip;
+    w.p3outcode = 0xFF;
+    w.p1x = 0xFFFF;
+    w.p1capture = &segments[c.first];
+
+    w.drawBatch(*inBatch,c.edges,edgeList + 2 * c.first);
+
+    c.segments = w.p1captureCount;
+    c.left = 0xFFFF;
+    c.top = 0xFFFF;
+    c.right = 0;
+    c.bottom = 0;
+    for (uint32_t i = 0; i < c.segments; ++i) {
+        const G3DSegment &seg = segments[c.first + i];
+        if (seg.x1 < c.left) c.left = seg.x1;
+        if (seg.x2 < c.left) c.left = seg.x2;
+        if (seg.x1 > c.right) c.right = seg.x1;
+        if (seg.x2 > c.right) c.right = seg.x2;
+        if (seg.y1 < c.top) c.top = seg.y1;
+        if (seg.y2 < c.top) c.top = seg.y2;
+        if (seg.y1 > c.bottom) c.bottom = seg.y1;
+        if (seg.y2 > c.bottom) c.bottom = seg.y2;
+    }
+
+    c.p3used = (w.p3outcode != 0xFF);
+    c.pos = w.p3pos;
+    c.outcode = w.p3outcode;
+    c.p1used = (w.p1x != 0xFFFF);
+    c.pen = w.p1draw;
+    c.x = w.p1x;
+    c.y = w.p1y;
+#if G3D_STATS > 0
+    c.stats = w.getStats();
+#endif
+}
+
+/*	G3DParallel::rasterTask
+ *
+ *		Draw the rows of one strip: every segment which crosses it, in
+ *	order. Like G3D::p1band we walk each line from its start with the
+ *	same Bresenham steps as stage 1, so the strip gets exactly the
+ *	pixels of the whole line, and stop once the line leaves the strip.
+ */
+
+void G3DParallel::rasterTask(uint32_t index)
+{
+    G3DFrameBuffer &lib = target->lib;
+    uint8_t *buffer = lib.getBuffer();
+    bool mono = (lib.format() == G3D_FORMAT_MONO);
+    int16_t w = lib.width();
+    uint16_t color = target->color;
+    int16_t xoffset = target->xoffset;
+    int16_t yoffset = target->yoffset;
+
+    int16_t top = stripBase + index * stripRows;
+    int16_t bottom = top + stripRows;
+    if (top < yoffset) top = yoffset;
+    if (bottom > yoffset + (int16_t)target->height) bottom = yoffset + target->height;
+    if (bottom > (int16_t)lib.height()) bottom = lib.height();
+
+    uint32_t pixels = 0;
+
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        const Chunk &c = chunks[i];
+        if ((c.segments == 0) || (yoffset + c.bottom < top) || (yoffset + c.top >= bottom)) continue;
+
+        const G3DSegment *seg = &segments[c.first];
+        for (uint32_t j = 0; j < c.segments; ++j, ++seg) {
+            int16_t x0 = xoffset + seg->x1;
+            int16_t y0 = yoffset + seg->y1;
+            int16_t x1 = xoffset + seg->x2;
+            int16_t y1 = yoffset + seg->y2;
+            if ((y0 < top) && (y1 < top)) continue;
+            if ((y0 >= bottom) && (y1 >= bottom)) continue;
+
+            int16_t dx = x1 - x0;
+            int16_t dy = y1 - y0;
+            int16_t sx = 1;
+            int16_t sy = 1;
+
+            if (dx < 0) {
+                dx = -dx;
+                sx = -1;
+            }
+            if (dy < 0) {
+                dy = -dy;
+                sy = -1;
+            }
+
+            int16_t err = dx - dy;
+            for (;;) {
+                if ((y0 >= top) && (y0 < bottom)) {
+                    if (x0 < w) {
+                        if (mono) {
+                            uint8_t *ptr = buffer + (y0 >> 3) * w + x0;
+                            if (color) {
+                                *ptr |= 1 << (y0 & 7);
+                            } else {
+                                *ptr &= ~(1 << (y0 & 7));
+                            }
+                        } else {
+                            ((uint16_t *)buffer)[(uint32_t)y0 * w + x0] = color;
+                        }
+                        ++pixels;
+                    }
+                } else if ((sy > 0) ? (y0 >= bottom) : (y0 < top)) {
+                    break;
+                }
+                if ((x0 == x1) && (y0 == y1)) break;
+
+                int16_t e2 = err * 2;
+                if (e2 > -dy) {
+                    err -= dy;
+                    x0 += sx;
+                }
+                if (e2 < dx) {
+                    err += dx;
+                    y0 += sy;
+                }
+            }
+        }
+    }
+
+#if G3D_STATS > 0
+    stripPixels[index] = pixels;
+#else
+    (void)pixels;
+#endif
+}
+
+#endif // G3D_PARALLEL
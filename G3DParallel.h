@@ -0,0 +1,139 @@
+/*  G3DParallel.h
+ *
+ *      Multithreaded drawing of large wireframes on a desktop machine.
+ *  G3DParallel::transformBatch and G3DParallel::drawBatch do the same
+ *  work as G3D::transformBatch and G3D::drawBatch, and draw exactly the
+ *  same pixels, but share it across a pool of threads. Only built with
+ *  G3D_PARALLEL set.
+ */
+
+#ifndef _G3DPARALLEL_H
+#define _G3DPARALLEL_H
+
+#include "G3D.h"
+
+#if G3D_PARALLEL
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/********************************************************************/
+/*                                                                  */
+/*  G3DParallel														*/
+/*                                                                  */
+/********************************************************************/
+
+/*  G3DParallel
+ *
+ *      A thread pool which draws batches for a G3D. The G3D supplies the
+ *  transformation, viewport, color and clipping, and is left as if it
+ *  had drawn the batch itself.
+ *
+ *      drawBatch runs in two passes. First the edges are split into
+ *  chunks, and each chunk is run through stages 3 and 2 by a private
+ *  pipeline which records the segments stage 1 would draw. Then the
+ *  viewport is split into strips of whole 8 row pages, and each strip
+ *  draws every segment which crosses it, in order, plotting only its
+ *  own rows; no two threads ever write the same byte. Each chunk starts
+ *  with a move, which gives the same segments as continuing from the
+ *  last edge, so the pixels are the same as G3D::drawBatch.
+ *
+ *      Monochrome buffers mark the bounding rectangle of the batch dirty
+ *  rather than each line, so a flush may send a few more blocks.
+ */
+
+class G3DParallel
+{
+    public:
+                G3DParallel(uint8_t threads = 0);	// 0: one per core
+                ~G3DParallel();
+
+        uint8_t threadCount() const
+                    {
+                        return (uint8_t)(pool.size() + 1);
+                    }
+
+        void    transformBatch(G3D &draw, const G3DScalar *x, const G3DScalar *y, const G3DScalar *z, G3DBatch &out);
+        void    drawBatch(G3D &draw, const G3DBatch &batch, uint32_t edgeCount, const uint32_t *edges);
+
+    private:
+        /*
+         *  Thread pool. run() hands tasks 0 through count-1 to the pool
+         *  and the calling thread, and returns when all are done.
+         */
+
+        typedef void (G3DParallel::*Task)(uint32_t index);
+
+        std::vector<std::thread> pool;
+        std::mutex lock;
+        std::condition_variable wake;
+        std::condition_variable idle;
+        uint32_t generation;            // incremented for each run
+        uint32_t running;               // pool threads still in this run
+        bool    quit;
+        Task    task;
+        uint32_t taskCount;
+        std::atomic<uint32_t> nextTask;
+
+        void    worker();
+        void    run(Task t, uint32_t count);
+
+        /*
+         *  The batch being drawn
+         */
+
+        struct Chunk {
+            uint32_t first;             // first edge, and first segment
+            uint32_t edges;
+            uint32_t segments;          // segments recorded
+            uint16_t left;              // bounds of the segments
+            uint16_t top;
+            uint16_t right;
+            uint16_t bottom;
+
+            /*
+             *  Pipeline state at the end of the chunk, for the G3D, if
+             *  the chunk reached stage 3 (p3used) or stage 1 (p1used)
+             */
+
+            bool    p3used;
+            G3DVector pos;
+            uint8_t outcode;
+            bool    p1used;
+            bool    pen;
+            uint16_t x;
+            uint16_t y;
+#if G3D_STATS > 0
+            G3DStats stats;
+#endif
+        };
+
+        G3D     *target;
+        const G3DScalar *srcX;
+        const G3DScalar *srcY;
+        const G3DScalar *srcZ;
+        G3DBatch *outBatch;
+        const G3DBatch *inBatch;
+        const uint32_t *edgeList;
+        uint32_t chunkSize;
+
+        std::vector<Chunk> chunks;
+        std::vector<G3DSegment> segments;
+        uint16_t stripBase;             // first row of strip 0, on a page
+        uint16_t stripRows;             // rows per strip, whole pages
+#if G3D_STATS > 0
+        std::vector<uint32_t> stripPixels;
+#endif
+
+        void    transformTask(uint32_t index);
+        void    clipTask(uint32_t index);
+        void    rasterTask(uint32_t index);
+};
+
+#endif // G3D_PARALLEL
+
+#endif // _G3DPARALLEL_H
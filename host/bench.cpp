@@ -0,0 +1,673 @@
+/*  bench.cpp
+ *
+ *      Micro-benchmarks for the G3D pipeline on a desktop machine. Each
+ *  benchmark runs a fixed workload generated from a fixed seed, so the
+ *  results can be compared from run to run and from build to build.
+ *  Build with USELIBRARY=3; see README.md.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include "G3D.h"
+#include "G3DParallel.h"
+
+#if USELIBRARY != 3
+#error The desktop build requires USELIBRARY=3
+#endif
+
+/********************************************************************/
+/*                                                                  */
+/*  Workloads														*/
+/*                                                                  */
+/********************************************************************/
+
+/*
+ *  The clipping workloads are generated directly in clip space and
+ *  drawn with an identity transformation, so each segment is known to
+ *  be inside, outside or crossing exactly the walls we intend: inside
+ *  is -1 <= x,y <= 1 and -1 <= z <= 0.
+ */
+
+#define SEGMENTS        4096
+
+typedef std::vector<G3DScalar> Points;     // x,y,z triplets
+
+/*	Random
+ *
+ *		A small xorshift generator, so the workloads are the same on
+ *	every machine and with every C library
+ */
+
+class Random
+{
+    public:
+                Random(uint32_t seed)
+                    {
+                        state = seed;
+                    }
+
+        uint32_t next()
+                    {
+                        state ^= state << 13;
+                        state ^= state >> 17;
+                        state ^= state << 5;
+                        return state;
+                    }
+        float   uniform(float lo, float hi)
+                    {
+                        return lo + (hi - lo) * (next() >> 8) / 16777216.0f;
+                    }
+
+    private:
+        uint32_t state;
+};
+
+static void addPoint(Points &p, float x, float y, float z)
+{
+    p.push_back(x);
+    p.push_back(y);
+    p.push_back(z);
+}
+
+/*	outside
+ *
+ *		A coordinate beyond the view volume on the side given by sign
+ */
+
+static float outside(Random &r, int sign)
+{
+    return sign * r.uniform(1.1f,3.0f);
+}
+
+/*	makeAccept
+ *
+ *		Short segments entirely inside the view, so the cost is in the
+ *	pipeline rather than in drawing pixels
+ */
+
+static void makeAccept(Points &p, Random &r)
+{
+    for (int i = 0; i < SEGMENTS; ++i) {
+        float x = r.uniform(-0.9f,0.9f);
+        float y = r.uniform(-0.9f,0.9f);
+        float z = r.uniform(-0.9f,-0.1f);
+        addPoint(p,x,y,z);
+        addPoint(p,x + r.uniform(-0.05f,0.05f),y + r.uniform(-0.05f,0.05f),z + r.uniform(-0.05f,0.05f));
+    }
+}
+
+/*	makeReject
+ *
+ *		Segments with both ends beyond the same wall, cycling through
+ *	all six walls
+ */
+
+static void makeReject(Points &p, Random &r)
+{
+    for (int i = 0; i < SEGMENTS; ++i) {
+        for (int j = 0; j < 2; ++j) {
+            float x = r.uniform(-0.9f,0.9f);
+            float y = r.uniform(-0.9f,0.9f);
+            float z = r.uniform(-0.9f,-0.1f);
+            switch (i % 6) {
+                case 0: x = outside(r,-1); break;
+                case 1: x = outside(r,1); break;
+                case 2: y = outside(r,-1); break;
+                case 3: y = outside(r,1); break;
+                case 4: z = -outside(r,1); break;
+                case 5: z = r.uniform(0.1f,1.0f); break;
+            }
+            addPoint(p,x,y,z);
+        }
+    }
+}
+
+/*	makeClip1
+ *
+ *		Segments from inside the view to beyond one of the side walls
+ */
+
+static void makeClip1(Points &p, Random &r)
+{
+    for (int i = 0; i < SEGMENTS; ++i) {
+        addPoint(p,r.uniform(-0.9f,0.9f),r.uniform(-0.9f,0.9f),r.uniform(-0.9f,-0.1f));
+
+        float x = r.uniform(-0.9f,0.9f);
+        float y = r.uniform(-0.9f,0.9f);
+        switch (i % 4) {
+            case 0: x = outside(r,-1); break;
+            case 1: x = outside(r,1); break;
+            case 2: y = outside(r,-1); break;
+            case 3: y = outside(r,1); break;
+        }
+        addPoint(p,x,y,r.uniform(-0.9f,-0.1f));
+    }
+}
+
+/*	makeClipN
+ *
+ *		Segments across the view between opposite corners, with both
+ *	ends beyond two walls
+ */
+
+static void makeClipN(Points &p, Random &r)
+{
+    for (int i = 0; i < SEGMENTS; ++i) {
+        int sx = (i & 1) ? 1 : -1;
+        int sy = (i & 2) ? 1 : -1;
+        addPoint(p,outside(r,sx),outside(r,sy),r.uniform(-0.9f,-0.1f));
+        addPoint(p,outside(r,-sx),outside(r,-sy),r.uniform(-0.9f,-0.1f));
+    }
+}
+
+/*	makeNear
+ *
+ *		Segments from inside the view to in front of the near plane
+ */
+
+static void makeNear(Points &p, Random &r)
+{
+    for (int i = 0; i < SEGMENTS; ++i) {
+        addPoint(p,r.uniform(-0.9f,0.9f),r.uniform(-0.9f,0.9f),r.uniform(-0.9f,-0.1f));
+        addPoint(p,r.uniform(-0.9f,0.9f),r.uniform(-0.9f,0.9f),r.uniform(0.1f,1.0f));
+    }
+}
+
+/*	makePoints
+ *
+ *		Points inside the view
+ */
+
+static void makePoints(Points &p, Random &r)
+{
+    for (int i = 0; i < SEGMENTS; ++i) {
+        addPoint(p,r.uniform(-0.9f,0.9f),r.uniform(-0.9f,0.9f),r.uniform(-0.9f,-0.1f));
+    }
+}
+
+/*	makeRaster
+ *
+ *		Long segments inside the view, half mostly horizontal and half
+ *	mostly vertical, so the cost is in drawing pixels
+ */
+
+static void makeRaster(Points &p, Random &r)
+{
+    for (int i = 0; i < SEGMENTS; ++i) {
+        float a = r.uniform(-0.95f,-0.5f);
+        float b = r.uniform(0.5f,0.95f);
+        float c = r.uniform(-0.95f,0.95f);
+        float d = r.uniform(-0.95f,0.95f);
+        if (i & 2) std::swap(a,b);
+        if (i & 1) {
+            addPoint(p,c,a,-0.5f);
+            addPoint(p,d,b,-0.5f);
+        } else {
+            addPoint(p,a,c,-0.5f);
+            addPoint(p,b,d,-0.5f);
+        }
+    }
+}
+
+/*	makeScene
+ *
+ *		A scene of connected strips of 16 edges, wandering through a
+ *	cube around the origin which is larger than the view, so some of it
+ *	is clipped and some rejected. Returns the number of strips; each is
+ *	17 points.
+ */
+
+#define SCENESTRIP      16
+
+static uint32_t makeScene(Points &p, Random &r, uint32_t edges)
+{
+    uint32_t strips = (edges + SCENESTRIP - 1) / SCENESTRIP;
+    for (uint32_t i = 0; i < strips; ++i) {
+        float x = r.uniform(-3,3);
+        float y = r.uniform(-3,3);
+        float z = r.uniform(-3,3);
+        for (int j = 0; j <= SCENESTRIP; ++j) {
+            addPoint(p,x,y,z);
+            x += r.uniform(-0.3f,0.3f);
+            y += r.uniform(-0.3f,0.3f);
+            z += r.uniform(-0.3f,0.3f);
+        }
+    }
+    return strips;
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Drawing															*/
+/*                                                                  */
+/********************************************************************/
+
+static void drawSegments(G3D &draw, const Points &p)
+{
+    draw.begin();
+    for (size_t i = 0; i < p.size(); i += 6) {
+        draw.move(p[i],p[i+1],p[i+2]);
+        draw.draw(p[i+3],p[i+4],p[i+5]);
+    }
+    draw.end();
+}
+
+static void drawPoints(G3D &draw, const Points &p)
+{
+    draw.begin();
+    for (size_t i = 0; i < p.size(); i += 3) {
+        draw.point(p[i],p[i+1],p[i+2]);
+    }
+    draw.end();
+}
+
+static void drawStrips(G3D &draw, const Points &p)
+{
+    draw.begin();
+    for (size_t i = 0; i < p.size(); i += 3 * (SCENESTRIP + 1)) {
+        draw.move(p[i],p[i+1],p[i+2]);
+        for (int j = 1; j <= SCENESTRIP; ++j) {
+            const G3DScalar *v = &p[i + 3 * j];
+            draw.draw(v[0],v[1],v[2]);
+        }
+    }
+    draw.end();
+}
+
+/*	countPixels
+ *
+ *		Count the pixels in each segment by drawing them one at a time
+ *	into a clear framebuffer
+ */
+
+static long countPixels(G3D &draw, G3DFrameBuffer &fb, const Points &p)
+{
+    long pixels = 0;
+    for (size_t i = 0; i < p.size(); i += 6) {
+        fb.clear();
+        Points one(p.begin() + i,p.begin() + i + 6);
+        drawSegments(draw,one);
+
+        const uint8_t *b = fb.getBuffer();
+        for (uint32_t j = 0; j < fb.bufferSize(); ++j) {
+            pixels += __builtin_popcount(b[j]);
+        }
+    }
+    fb.clear();
+    return pixels;
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Timing															*/
+/*                                                                  */
+/********************************************************************/
+
+static int GTrials = 7;
+static double GMinTime = 20;        // milliseconds per trial
+static volatile float GSink;        // keeps matrix results alive
+
+/*	Bench
+ *
+ *		A benchmark: a workload run by run(), made of items units.
+ */
+
+struct Bench {
+    const char *name;
+    long        items;
+    const char *unit;
+    void        (*run)(void *context);
+    void        *context;
+    G3D         *draw;      // pipeline whose statistics to show, or NULL
+};
+
+/*	timeBench
+ *
+ *		Time a benchmark. We find how many passes take GMinTime, then
+ *	time that many passes GTrials times, and report the fastest and the
+ *	median trial in nanoseconds per item. The fastest is the least
+ *	disturbed by the rest of the machine, so it is the one to compare.
+ */
+
+static void timeBench(const Bench &b)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    long passes = 1;
+    for (;;) {
+        Clock::time_point start = Clock::now();
+        for (long i = 0; i < passes; ++i) b.run(b.context);
+        double ms = std::chrono::duration<double,std::milli>(Clock::now() - start).count();
+        if ((ms >= GMinTime) || (passes >= (1L << 24))) break;
+        passes = (ms * 2 < GMinTime) ? passes * 2 : (long)(passes * GMinTime / ms) + 1;
+    }
+
+    std::vector<double> ns;
+    for (int t = 0; t < GTrials; ++t) {
+        Clock::time_point start = Clock::now();
+        for (long i = 0; i < passes; ++i) b.run(b.context);
+        double elapsed = std::chrono::duration<double,std::nano>(Clock::now() - start).count();
+        ns.push_back(elapsed / ((double)passes * b.items));
+    }
+    std::sort(ns.begin(),ns.end());
+
+    printf("%-12s %9ld %-8s %10.2f ns %10.2f ns\n",b.name,b.items,b.unit,ns[0],ns[ns.size() / 2]);
+
+#if G3D_STATS > 0
+    /*
+     *  Show where one pass went, to check the workload takes the paths
+     *  we expect
+     */
+
+    if (b.draw) {
+        b.draw->clearStats();
+        b.run(b.context);
+        const G3DStats &s = b.draw->getStats();
+        printf("%12s %u accepted, %u rejected, %u clipped, %u guard band, %u divisions, %u pixels\n","",
+               s.accepted,s.rejected,s.clipped,s.guardBand,s.divisions,s.pixels);
+    }
+#endif
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Benchmarks														*/
+/*                                                                  */
+/********************************************************************/
+
+struct DrawContext {
+    G3D         *draw;
+    const Points *points;
+};
+
+static void runSegments(void *c)
+{
+    DrawContext *d = (DrawContext *)c;
+    drawSegments(*d->draw,*d->points);
+}
+
+static void runPoints(void *c)
+{
+    DrawContext *d = (DrawContext *)c;
+    drawPoints(*d->draw,*d->points);
+}
+
+static void runStrips(void *c)
+{
+    DrawContext *d = (DrawContext *)c;
+    drawStrips(*d->draw,*d->points);
+}
+
+/*
+ *  A scene as a batch: vertices in structure of arrays form and edges
+ *  as index pairs, drawn with G3D::transformBatch and G3D::drawBatch,
+ *  or with G3DParallel when there is one
+ */
+
+struct BatchContext {
+    G3D         *draw;
+    std::vector<G3DScalar> xyz[3];
+    std::vector<G3DScalar> transformed[4];
+    std::vector<uint8_t> outcodes;
+    std::vector<uint32_t> edges;
+    G3DBatch    batch;
+#if G3D_PARALLEL
+    G3DParallel *parallel;
+#endif
+};
+
+static void runBatch(void *c)
+{
+    BatchContext *b = (BatchContext *)c;
+    G3D &draw = *b->draw;
+    draw.begin();
+#if G3D_PARALLEL
+    if (b->parallel) {
+        b->parallel->transformBatch(draw,b->xyz[0].data(),b->xyz[1].data(),b->xyz[2].data(),b->batch);
+        b->parallel->drawBatch(draw,b->batch,b->edges.size() / 2,b->edges.data());
+    } else
+#endif
+    {
+        draw.transformBatch(b->xyz[0].data(),b->xyz[1].data(),b->xyz[2].data(),b->batch);
+        draw.drawBatch(b->batch,b->edges.size() / 2,b->edges.data());
+    }
+    draw.end();
+}
+
+/*
+ *  Matrices: G3DMatrix::multiply on its own, and building the demo's
+ *  camera and object transformation
+ */
+
+#define MATRICES        1024
+
+static void runMultiply(void *c)
+{
+    const G3DMatrix &m = *(const G3DMatrix *)c;
+    G3DMatrix r;
+    for (int i = 0; i < MATRICES; ++i) {
+        r.multiply(m);
+    }
+    GSink = G3DToFloat(r.a[0][0]);
+}
+
+static void runChain(void *c)
+{
+    G3D &draw = *(G3D *)c;
+    for (int i = 0; i < MATRICES; ++i) {
+        float angle = i * 0.01f;
+        draw.transformation.setIdentity();
+        draw.perspective(1.0f,0.5f);
+        draw.translate(0,0,-5);
+        draw.rotate(AXIS_X,angle);
+        draw.rotate(AXIS_Y,angle * 2);
+    }
+    GSink = G3DToFloat(draw.transformation.a[0][0]);
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Main															*/
+/*                                                                  */
+/********************************************************************/
+
+static void usage()
+{
+    fprintf(stderr,"usage: g3dbench [-trials n] [-time ms] [-threads n] [benchmark ...]\n");
+    exit(1);
+}
+
+/*	selected
+ *
+ *		True if the benchmark was named on the command line, or none
+ *	were
+ */
+
+static bool selected(const std::vector<const char *> &names, const char *name)
+{
+    if (names.empty()) return true;
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (!strcmp(names[i],name)) return true;
+    }
+    return false;
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<const char *> names;
+    int threads = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i],"-trials") && (i+1 < argc)) {
+            GTrials = atoi(argv[++i]);
+        } else if (!strcmp(argv[i],"-time") && (i+1 < argc)) {
+            GMinTime = atof(argv[++i]);
+        } else if (!strcmp(argv[i],"-threads") && (i+1 < argc)) {
+            threads = atoi(argv[++i]);
+        } else if (argv[i][0] == '-') {
+            usage();
+        } else {
+            names.push_back(argv[i]);
+        }
+    }
+    if ((GTrials < 1) || (GMinTime <= 0)) usage();
+    if ((threads < 0) || (threads > 255) || ((threads != 1) && (G3D_PARALLEL == 0))) usage();
+
+    /*
+     *  Everything draws into the Arduboy's 128x64 monochrome display
+     */
+
+    G3DFrameBuffer fb(G3D_FORMAT_MONO,128,64);
+    G3D draw(fb,0,0,128,64);
+    draw.setColor(1);
+
+    printf("%-12s %9s %-8s %13s %13s\n","benchmark","items","unit","fastest","median");
+
+    /*
+     *  Clip space workloads
+     */
+
+    struct {
+        const char *name;
+        void        (*make)(Points &p, Random &r);
+    } segments[] = {
+        { "accept", makeAccept },
+        { "reject", makeReject },
+        { "clip1", makeClip1 },
+        { "clipN", makeClipN },
+        { "near", makeNear }
+    };
+
+    Points points;
+    DrawContext context = { &draw, &points };
+    for (size_t i = 0; i < sizeof(segments) / sizeof(segments[0]); ++i) {
+        if (!selected(names,segments[i].name)) continue;
+
+        Random r(1 + i);
+        points.clear();
+        segments[i].make(points,r);
+        draw.transformation.setIdentity();
+
+        Bench b = { segments[i].name, SEGMENTS, "segment", runSegments, &context, &draw };
+        timeBench(b);
+    }
+
+    if (selected(names,"point")) {
+        Random r(101);
+        points.clear();
+        makePoints(points,r);
+        draw.transformation.setIdentity();
+
+        Bench b = { "point", SEGMENTS, "point", runPoints, &context, &draw };
+        timeBench(b);
+    }
+
+    if (selected(names,"raster")) {
+        Random r(102);
+        points.clear();
+        makeRaster(points,r);
+        draw.transformation.setIdentity();
+
+        Bench b = { "raster", countPixels(draw,fb,points), "pixel", runSegments, &context, &draw };
+        timeBench(b);
+    }
+
+    /*
+     *  Matrices
+     */
+
+    if (selected(names,"multiply")) {
+        G3DMatrix m;
+        m.setRotate(AXIS_Y,0.01f);
+        Bench b = { "multiply", MATRICES, "multiply", runMultiply, &m, NULL };
+        timeBench(b);
+    }
+
+    if (selected(names,"chain")) {
+        Bench b = { "chain", MATRICES, "chain", runChain, &draw, NULL };
+        timeBench(b);
+    }
+
+    /*
+     *  Whole scenes through a perspective camera
+     */
+
+    static const struct {
+        const char *name;
+        uint32_t    edges;
+    } scenes[] = {
+        { "scene1k", 1000 },
+        { "scene10k", 10000 },
+        { "scene100k", 100000 },
+        { "scene1m", 1000000 }
+    };
+
+    for (size_t i = 0; i < sizeof(scenes) / sizeof(scenes[0]); ++i) {
+        if (!selected(names,scenes[i].name)) continue;
+
+        Random r(201 + i);
+        points.clear();
+        uint32_t strips = makeScene(points,r,scenes[i].edges);
+        draw.transformation.setIdentity();
+        draw.perspective(1.0f,0.5f);
+        draw.translate(0,0,-6);
+        draw.rotate(AXIS_X,0.3f);
+        draw.rotate(AXIS_Y,0.5f);
+
+        Bench b = { scenes[i].name, (long)strips * SCENESTRIP, "edge", runStrips, &context, &draw };
+        timeBench(b);
+    }
+
+    /*
+     *  The 1M edge scene as a batch, which G3DParallel can share across
+     *  -threads n threads (0 for one per core)
+     */
+
+    if (selected(names,"batch1m")) {
+        Random r(204);
+        points.clear();
+        uint32_t strips = makeScene(points,r,1000000);
+
+        BatchContext *bc = new BatchContext;
+        bc->draw = &draw;
+        for (size_t j = 0; j < points.size(); ++j) bc->xyz[j % 3].push_back(points[j]);
+        uint32_t count = points.size() / 3;
+        for (int j = 0; j < 4; ++j) bc->transformed[j].resize(count);
+        bc->outcodes.resize(count);
+        for (uint32_t j = 0; j < strips; ++j) {
+            for (uint32_t k = 0; k < SCENESTRIP; ++k) {
+                bc->edges.push_back(j * (SCENESTRIP + 1) + k);
+                bc->edges.push_back(j * (SCENESTRIP + 1) + k + 1);
+            }
+        }
+        bc->batch.count = count;
+        bc->batch.x = bc->transformed[0].data();
+        bc->batch.y = bc->transformed[1].data();
+        bc->batch.z = bc->transformed[2].data();
+        bc->batch.w = bc->transformed[3].data();
+        bc->batch.outcode = bc->outcodes.data();
+#if G3D_PARALLEL
+        bc->parallel = (threads != 1) ? new G3DParallel(threads) : NULL;
+#endif
+
+        draw.transformation.setIdentity();
+        draw.perspective(1.0f,0.5f);
+        draw.translate(0,0,-6);
+        draw.rotate(AXIS_X,0.3f);
+        draw.rotate(AXIS_Y,0.5f);
+
+        Bench b = { "batch1m", (long)strips * SCENESTRIP, "edge", runBatch, bc, &draw };
+        timeBench(b);
+
+#if G3D_PARALLEL
+        delete bc->parallel;
+#endif
+        delete bc;
+    }
+
+    return 0;
+}
@@ -0,0 +1,1037 @@
+/*  demo.cpp
+ *
+ *      Desktop build of the Arduino3D demo. This drives the G3D pipeline
+ *  into a G3DFrameBuffer so we can measure the cost of a frame without
+ *  flashing hardware. Build with USELIBRARY=3; see README.md.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "G3D.h"
+#include "G3DParallel.h"
+#include "G3DGovernor.h"
+
+#if USELIBRARY != 3
+#error The desktop build requires USELIBRARY=3
+#endif
+
+/********************************************************************/
+/*                                                                  */
+/*  Scene															*/
+/*                                                                  */
+/********************************************************************/
+
+static float GXAngle;
+static float GYAngle;
+
+static void transform(G3D &draw, float dist)
+{
+    draw.transformation.setIdentity();
+    draw.perspective(1.0f,0.5f);
+    draw.translate(0,0,-dist);
+    draw.rotate(AXIS_X,GXAngle);
+    draw.rotate(AXIS_Y,GYAngle);
+}
+
+/*	drawBox
+ *
+ *		Draw the demo box. This is written against either G3D or a
+ *	G3DDisplayList, which provide the same move/draw calls.
+ */
+
+template <class T> static void drawBox(T &draw, int x, int y, int z)
+{
+    draw.move(x-1,y-1,z-1);
+    draw.draw(x+1,y-1,z-1);
+    draw.draw(x+1,y+1,z-1);
+    draw.draw(x-1,y+1,z-1);
+    draw.draw(x-1,y-1,z-1);
+    draw.draw(x-1,y-1,z+1);
+    draw.draw(x+1,y-1,z+1);
+    draw.draw(x+1,y+1,z+1);
+    draw.draw(x-1,y+1,z+1);
+    draw.draw(x-1,y-1,z+1);
+    draw.move(x+1,y-1,z-1);
+    draw.draw(x+1,y-1,z+1);
+    draw.move(x+1,y+1,z-1);
+    draw.draw(x+1,y+1,z+1);
+    draw.move(x-1,y+1,z-1);
+    draw.draw(x-1,y+1,z+1);
+}
+
+/*
+ *  The same box as an indexed mesh
+ */
+
+static const G3DScalar CubeVertices[] = {
+    -1,-1,-1,  1,-1,-1,  1, 1,-1, -1, 1,-1,
+    -1,-1, 1,  1,-1, 1,  1, 1, 1, -1, 1, 1
+};
+
+static const uint16_t CubeEdges[] = {
+    0,1, 1,2, 2,3, 3,0, 0,4, 4,5, 5,6, 6,7, 7,4, 1,5, 2,6, 3,7
+};
+
+static const G3DMesh CubeMesh = { 8, 12, CubeVertices, CubeEdges };
+
+/*
+ *  And as a solid: faces -z, +z, -y, +y, -x, +x, and the faces either
+ *  side of each edge
+ */
+
+static const uint16_t CubeFaces[] = {
+    0,3,2, 4,5,6, 0,1,5, 3,7,6, 0,4,7, 1,2,6
+};
+
+static const uint16_t CubeEdgeFaces[] = {
+    0,2, 0,5, 0,3, 0,4, 2,4, 1,2, 1,5, 1,3, 1,4, 2,5, 3,5, 3,4
+};
+
+static const G3DSolidMesh CubeSolid = { 8, 12, 6, CubeVertices, CubeEdges, CubeEdgeFaces, CubeFaces };
+
+/*	drawScene
+ *
+ *		Draw a grid of size x size boxes centered on the origin. A size
+ *	of 1 is the original demo cube.
+ */
+
+static void drawScene(G3D &draw, int size, bool mesh, bool solid, bool cull, const G3DDisplayList *list)
+{
+    if (list) {
+        draw.drawList(*list);
+        return;
+    }
+
+    int start = -(size - 1) * 2;
+    for (int i = 0; i < size; ++i) {
+        for (int j = 0; j < size; ++j) {
+            if (cull) {
+                // Each box fits in a sphere of radius sqrt(3)
+                uint8_t c = draw.cullSphere(start + i * 4,start + j * 4,0,1.7321f);
+                if (c == G3D_OUTSIDE) continue;
+                draw.setClipping(c != G3D_INSIDE);
+            }
+            if (mesh || solid) {
+                G3DMatrix save = draw.transformation;
+                draw.translate(start + i * 4,start + j * 4,0);
+                if (solid) {
+                    draw.drawSolidMesh(CubeSolid);
+                } else {
+                    draw.drawMesh(CubeMesh);
+                }
+                draw.load(save);
+            } else {
+                drawBox(draw,start + i * 4,start + j * 4,0);
+            }
+        }
+    }
+}
+
+/*	buildSphere
+ *
+ *		Build a latitude/longitude sphere of radius 2 with the given
+ *	number of segments around. Edges are ordered as connected runs:
+ *	each latitude ring, then each meridian from pole to pole.
+ */
+
+static std::vector<G3DScalar> SphereVertices;	// x,y,z triplets
+static std::vector<uint32_t> SphereEdges;		// index pairs
+
+static void buildSphere(int segs)
+{
+    int rings = segs / 2;
+
+    SphereVertices.clear();
+    SphereEdges.clear();
+
+    for (int r = 1; r < rings; ++r) {
+        float lat = M_PI * r / rings;
+        for (int s = 0; s < segs; ++s) {
+            float lon = 2 * M_PI * s / segs;
+            SphereVertices.push_back(2 * sin(lat) * cos(lon));
+            SphereVertices.push_back(2 * cos(lat));
+            SphereVertices.push_back(2 * sin(lat) * sin(lon));
+        }
+    }
+    uint32_t north = (rings - 1) * segs;
+    uint32_t south = north + 1;
+    SphereVertices.push_back(0);
+    SphereVertices.push_back(2);
+    SphereVertices.push_back(0);
+    SphereVertices.push_back(0);
+    SphereVertices.push_back(-2);
+    SphereVertices.push_back(0);
+
+    for (int r = 0; r < rings - 1; ++r) {
+        for (int s = 0; s < segs; ++s) {
+            SphereEdges.push_back(r * segs + s);
+            SphereEdges.push_back(r * segs + (s + 1) % segs);
+        }
+    }
+    for (int s = 0; s < segs; ++s) {
+        uint32_t prev = north;
+        for (int r = 0; r < rings - 1; ++r) {
+            SphereEdges.push_back(prev);
+            SphereEdges.push_back(prev = r * segs + s);
+        }
+        SphereEdges.push_back(prev);
+        SphereEdges.push_back(south);
+    }
+}
+
+/*	buildSphereFaces
+ *
+ *		Find the faces of the sphere (quads between rings and triangles
+ *	around the poles) and the faces either side of each edge. Each face
+ *	is recorded by three of its vertices, turned to be counter-clockwise
+ *	seen from outside.
+ */
+
+static std::vector<uint16_t> SphereFaces;		// vertex triplets
+static std::vector<uint16_t> SphereEdgeFaces;	// face pairs
+
+static void buildSphereFaces(int segs)
+{
+    int rings = segs / 2;
+    uint32_t north = (rings - 1) * segs;
+    uint32_t south = north + 1;
+    std::vector<std::vector<uint32_t> > faces;
+
+    for (int s = 0; s < segs; ++s) {
+        uint32_t a = s;
+        uint32_t b = (s + 1) % segs;
+        uint32_t tri[3] = { north, a, b };
+        faces.push_back(std::vector<uint32_t>(tri,tri + 3));
+        for (int r = 0; r < rings - 2; ++r) {
+            uint32_t quad[4] = { r * segs + a, r * segs + b, (r + 1) * segs + b, (r + 1) * segs + a };
+            faces.push_back(std::vector<uint32_t>(quad,quad + 4));
+        }
+        uint32_t tri2[3] = { south, (rings - 2) * segs + a, (rings - 2) * segs + b };
+        faces.push_back(std::vector<uint32_t>(tri2,tri2 + 3));
+    }
+
+    SphereFaces.clear();
+    std::map<std::pair<uint32_t,uint32_t>,std::vector<uint16_t> > edgeFaces;
+    std::vector<float> v(SphereVertices.size());
+    for (size_t i = 0; i < v.size(); ++i) v[i] = G3DToFloat(SphereVertices[i]);
+    for (size_t f = 0; f < faces.size(); ++f) {
+        const std::vector<uint32_t> &p = faces[f];
+        for (size_t i = 0; i < p.size(); ++i) {
+            uint32_t a = p[i];
+            uint32_t b = p[(i + 1) % p.size()];
+            edgeFaces[std::make_pair(std::min(a,b),std::max(a,b))].push_back(f);
+        }
+
+        // Outward if the normal points away from the center
+        const float *a = &v[3 * p[0]];
+        const float *b = &v[3 * p[1]];
+        const float *c = &v[3 * p[2]];
+        float ux = b[0] - a[0], uy = b[1] - a[1], uz = b[2] - a[2];
+        float wx = c[0] - a[0], wy = c[1] - a[1], wz = c[2] - a[2];
+        float nx = uy * wz - uz * wy, ny = uz * wx - ux * wz, nz = ux * wy - uy * wx;
+        bool out = (nx * a[0] + ny * a[1] + nz * a[2]) > 0;
+        SphereFaces.push_back(p[0]);
+        SphereFaces.push_back(out ? p[1] : p[2]);
+        SphereFaces.push_back(out ? p[2] : p[1]);
+    }
+
+    SphereEdgeFaces.clear();
+    for (size_t i = 0; i < SphereEdges.size(); i += 2) {
+        uint32_t a = SphereEdges[i];
+        uint32_t b = SphereEdges[i+1];
+        const std::vector<uint16_t> &f = edgeFaces[std::make_pair(std::min(a,b),std::max(a,b))];
+        SphereEdgeFaces.push_back(f.size() > 0 ? f[0] : G3D_NOFACE);
+        SphereEdgeFaces.push_back(f.size() > 1 ? f[1] : G3D_NOFACE);
+    }
+}
+
+/*	buildSphereLOD
+ *
+ *		Levels of detail for the sphere. Each level keeps every other
+ *	ring and meridian of the one before, while that leaves 8 or more
+ *	segments, so its vertices are some of the last level's; they are
+ *	reordered so each level uses the start of the array. A level's error
+ *	is how far each vertex of the full sphere is from the nearest corner
+ *	of the level's grid cell around it.
+ */
+
+static std::vector<G3DScalar> LODVertices;
+static std::vector<std::vector<uint16_t> > LODEdges;
+static std::vector<G3DLODLevel> LODLevels;
+
+static void buildSphereLOD(int segs)
+{
+    int rings = segs / 2;
+    uint32_t north = (rings - 1) * segs;
+    uint32_t south = north + 1;
+    uint32_t count = south + 1;
+
+    int levels = 1;
+    while ((segs % (4 << (levels - 1)) == 0) && (segs / (2 << (levels - 1)) >= 8)) ++levels;
+
+    /*
+     *  Order the vertices by the coarsest level which keeps them, poles
+     *  first
+     */
+
+    std::vector<int> keep(count,levels - 1);
+    for (int r = 1; r < rings; ++r) {
+        for (int s = 0; s < segs; ++s) {
+            int k = 0;
+            while ((k + 1 < levels) && (r % (2 << k) == 0) && (s % (2 << k) == 0)) ++k;
+            keep[(r - 1) * segs + s] = k;
+        }
+    }
+    std::vector<uint32_t> vertices;
+    for (int k = levels - 1; k >= 0; --k) {
+        for (uint32_t i = 0; i < count; ++i) {
+            if (keep[i] == k) vertices.push_back(i);
+        }
+    }
+    std::vector<uint16_t> order(count);
+    LODVertices.clear();
+    for (uint32_t i = 0; i < count; ++i) {
+        order[vertices[i]] = i;
+        LODVertices.insert(LODVertices.end(),&SphereVertices[3 * vertices[i]],&SphereVertices[3 * vertices[i] + 3]);
+    }
+
+    LODEdges.assign(levels,std::vector<uint16_t>());
+    LODLevels.resize(levels);
+    for (int k = 0; k < levels; ++k) {
+        int t = 1 << k;
+        std::vector<uint16_t> &e = LODEdges[k];
+        for (int r = t; r < rings; r += t) {
+            for (int s = 0; s < segs; s += t) {
+                e.push_back(order[(r - 1) * segs + s]);
+                e.push_back(order[(r - 1) * segs + (s + t) % segs]);
+            }
+        }
+        for (int s = 0; s < segs; s += t) {
+            uint32_t prev = north;
+            for (int r = t; r < rings; r += t) {
+                e.push_back(order[prev]);
+                e.push_back(order[prev = (r - 1) * segs + s]);
+            }
+            e.push_back(order[prev]);
+            e.push_back(order[south]);
+        }
+
+        float error = 0;
+        for (int r = 1; r < rings; ++r) {
+            for (int s = 0; s < segs; ++s) {
+                const G3DScalar *v = &SphereVertices[3 * ((r - 1) * segs + s)];
+                float best = 1e9f;
+                for (int c = 0; c < 4; ++c) {
+                    int cr = (r / t + (c & 1)) * t;
+                    int cs = ((s / t + (c >> 1)) * t) % segs;
+                    uint32_t corner = (cr == 0) ? north : (cr >= rings) ? south : (cr - 1) * segs + cs;
+                    const G3DScalar *w = &SphereVertices[3 * corner];
+                    float dx = G3DToFloat(v[0] - w[0]);
+                    float dy = G3DToFloat(v[1] - w[1]);
+                    float dz = G3DToFloat(v[2] - w[2]);
+                    best = std::min(best,sqrtf(dx * dx + dy * dy + dz * dz));
+                }
+                error = std::max(error,best);
+            }
+        }
+
+        G3DLODLevel &l = LODLevels[k];
+        l.vertexCount = (k == 0) ? count : 2 + (rings / t - 1) * (segs / t);
+        l.edgeCount = e.size() / 2;
+        l.edges = e.data();
+        l.error = error;
+    }
+}
+
+/*	drawSphere
+ *
+ *		Draw the sphere with move/draw calls, transforming each edge
+ *	endpoint as it is drawn
+ */
+
+static void drawSphere(G3D &draw)
+{
+    const G3DScalar *v = SphereVertices.data();
+    uint32_t last = 0xFFFFFFFF;
+
+    for (size_t i = 0; i < SphereEdges.size(); i += 2) {
+        uint32_t a = SphereEdges[i];
+        uint32_t b = SphereEdges[i+1];
+        if (a != last) draw.move(v[3*a],v[3*a+1],v[3*a+2]);
+        draw.draw(v[3*b],v[3*b+1],v[3*b+2]);
+        last = b;
+    }
+}
+
+/*	drawFan
+ *
+ *		Draw a line from the center of a width x height viewport to
+ *	each pixel around its edge, to measure line fill rate. Coordinates
+ *	are chosen so stage 2 lands exactly on each pixel, which lets us
+ *	count the pixels Bresenham plots: the longer axis plus one. Returns
+ *	the number of pixels drawn.
+ */
+
+static long drawFan(G3D &draw, int width, int height)
+{
+    draw.transformation.setIdentity();
+
+    float xscale = (width - 1) / 2.0f;
+    float yscale = (height - 1) / 2.0f;
+    int cx = width / 2;
+    int cy = height / 2;
+    long pixels = 0;
+
+    for (int i = 0; i < 2 * (width + height); ++i) {
+        int px, py;
+        if (i < width) {
+            px = i;
+            py = 0;
+        } else if (i < 2 * width) {
+            px = i - width;
+            py = height - 1;
+        } else if (i < 2 * width + height) {
+            px = 0;
+            py = i - 2 * width;
+        } else {
+            px = width - 1;
+            py = i - 2 * width - height;
+        }
+
+        draw.move((cx + 0.5f - width / 2.0f) / xscale,(height / 2.0f - cy - 0.5f) / yscale,-0.5f);
+        draw.draw((px + 0.5f - width / 2.0f) / xscale,(height / 2.0f - py - 0.5f) / yscale,-0.5f);
+        pixels += 1 + std::max(abs(px - cx),abs(py - cy));
+    }
+    return pixels;
+}
+
+/*	mapModel
+ *
+ *		Map a compact mesh written by g3dmesh into memory, so it can be
+ *	drawn in place with G3D::drawCompactMesh
+ */
+
+static const uint8_t *mapModel(const char *path, size_t &size)
+{
+    int fd = open(path,O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    void *data = MAP_FAILED;
+    if ((fstat(fd,&st) == 0) && (st.st_size >= G3D_COMPACT_HEADER)) {
+        size = st.st_size;
+        data = mmap(NULL,size,PROT_READ,MAP_PRIVATE,fd,0);
+    }
+    close(fd);
+    return (data == MAP_FAILED) ? NULL : (const uint8_t *)data;
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Image output													*/
+/*                                                                  */
+/********************************************************************/
+
+/*	writeImage
+ *
+ *		Write the framebuffer as a PBM (monochrome) or PPM (RGB565) file
+ */
+
+static bool writeImage(G3DFrameBuffer &fb, const char *path)
+{
+    FILE *f = fopen(path,"wb");
+    if (f == NULL) return false;
+
+    if (fb.format() == G3D_FORMAT_MONO) {
+        fprintf(f,"P1\n%d %d\n",fb.width(),fb.height());
+        for (int y = 0; y < fb.height(); ++y) {
+            for (int x = 0; x < fb.width(); ++x) {
+                fputc(fb.getPixel(x,y) ? '1' : '0',f);
+            }
+            fputc('\n',f);
+        }
+    } else {
+        fprintf(f,"P6\n%d %d\n255\n",fb.width(),fb.height());
+        for (int y = 0; y < fb.height(); ++y) {
+            for (int x = 0; x < fb.width(); ++x) {
+                uint16_t c = fb.getPixel(x,y);
+                fputc(((c >> 11) & 0x1F) << 3,f);
+                fputc(((c >> 5) & 0x3F) << 2,f);
+                fputc((c & 0x1F) << 3,f);
+            }
+        }
+    }
+
+    fclose(f);
+    return true;
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Display Sink													*/
+/*                                                                  */
+/********************************************************************/
+
+/*	CountingSink
+ *
+ *		Stands in for the SPI connection to the Arduboy's SSD1306. This
+ *	counts the bytes and transfers G3DFrameBuffer::flush sends, and
+ *	keeps a copy of the display memory so we can check the display
+ *	ends up matching the framebuffer.
+ */
+
+class CountingSink : public G3DDisplaySink
+{
+    public:
+        long commandBytes;
+        long dataBytes;
+        long transfers;
+        std::vector<uint8_t> display;
+
+                CountingSink(uint16_t width, uint16_t height) : display(width * ((height + 7) >> 3))
+                    {
+                        commandBytes = 0;
+                        dataBytes = 0;
+                        transfers = 0;
+                        w = width;
+                        ncmd = 0;
+                        col = colStart = colEnd = 0;
+                        page = pageEnd = 0;
+                    }
+
+        void    command(uint8_t c)
+                    {
+                        ++commandBytes;
+                        cmd[ncmd++] = c;
+                        if (ncmd == 3) {
+                            if (cmd[0] == 0x21) {
+                                col = colStart = cmd[1];
+                                colEnd = cmd[2];
+                            } else if (cmd[0] == 0x22) {
+                                page = cmd[1];
+                                pageEnd = cmd[2];
+                            }
+                            ncmd = 0;
+                        }
+                    }
+
+        void    data(const uint8_t *d, uint16_t length)
+                    {
+                        ++transfers;
+                        dataBytes += length;
+                        while (length--) {
+                            if ((uint32_t)page * w + col < display.size()) display[page * w + col] = *d;
+                            ++d;
+                            if (col++ == colEnd) {
+                                col = colStart;
+                                if (page++ == pageEnd) page = cmd[1];
+                            }
+                        }
+                    }
+
+    private:
+        uint16_t w;
+        uint8_t cmd[3];
+        uint8_t ncmd;
+        uint8_t col, colStart, colEnd;
+        uint8_t page, pageEnd;
+};
+
+/********************************************************************/
+/*                                                                  */
+/*  Main															*/
+/*                                                                  */
+/********************************************************************/
+
+static void usage()
+{
+    fprintf(stderr,"usage: g3ddemo [-rgb] [-frames n] [-grid n | -sphere n | -model file] [-mesh | -solid | -instance | -list | -batch [-threads n] | -lod px [-govern fps]] [-cull] [-fill] [-erase n] [-bands n] [-flush] [-dist d] [-o image]\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    bool rgb = false;
+    int frames = 1000;
+    int grid = 1;
+    int sphere = 0;
+    const char *modelPath = NULL;
+    bool mesh = false;
+    bool instance = false;
+    bool solid = false;
+    bool list = false;
+    bool batch = false;
+    int threads = 1;
+    float lod = 0;
+    int govern = 0;
+    bool cull = false;
+    bool fill = false;
+    int erase = 0;
+    int bands = 0;
+    bool flush = false;
+    float dist = 0;
+    const char *output = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i],"-rgb")) {
+            rgb = true;
+        } else if (!strcmp(argv[i],"-frames") && (i+1 < argc)) {
+            frames = atoi(argv[++i]);
+        } else if (!strcmp(argv[i],"-grid") && (i+1 < argc)) {
+            grid = atoi(argv[++i]);
+        } else if (!strcmp(argv[i],"-sphere") && (i+1 < argc)) {
+            sphere = atoi(argv[++i]);
+        } else if (!strcmp(argv[i],"-model") && (i+1 < argc)) {
+            modelPath = argv[++i];
+        } else if (!strcmp(argv[i],"-mesh")) {
+            mesh = true;
+        } else if (!strcmp(argv[i],"-solid")) {
+            solid = true;
+        } else if (!strcmp(argv[i],"-instance")) {
+            instance = true;
+        } else if (!strcmp(argv[i],"-list")) {
+            list = true;
+        } else if (!strcmp(argv[i],"-batch")) {
+            batch = true;
+        } else if (!strcmp(argv[i],"-threads") && (i+1 < argc)) {
+            threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i],"-lod") && (i+1 < argc)) {
+            lod = atof(argv[++i]);
+        } else if (!strcmp(argv[i],"-govern") && (i+1 < argc)) {
+            govern = atoi(argv[++i]);
+        } else if (!strcmp(argv[i],"-cull")) {
+            cull = true;
+        } else if (!strcmp(argv[i],"-fill")) {
+            fill = true;
+        } else if (!strcmp(argv[i],"-erase") && (i+1 < argc)) {
+            erase = atoi(argv[++i]);
+        } else if (!strcmp(argv[i],"-bands") && (i+1 < argc)) {
+            bands = atoi(argv[++i]);
+        } else if (!strcmp(argv[i],"-flush")) {
+            flush = true;
+        } else if (!strcmp(argv[i],"-dist") && (i+1 < argc)) {
+            dist = atof(argv[++i]);
+        } else if (!strcmp(argv[i],"-o") && (i+1 < argc)) {
+            output = argv[++i];
+        } else {
+            usage();
+        }
+    }
+    if ((frames < 1) || (grid < 1) || (sphere < 0) || (sphere == 1) || (flush && rgb)) usage();
+    if ((bands < 0) || (bands && (erase || (G3D_BANDS == 0)))) usage();
+    if ((lod < 0) || (lod && (!sphere || (sphere > 360)))) usage();
+    if ((govern < 0) || (govern && !lod)) usage();
+    if ((threads < 0) || (threads > 255) || ((threads != 1) && (!batch || bands || (G3D_PARALLEL == 0)))) usage();
+
+    /*
+     *  Match the displays used by the sketch: the Arduboy draws into a
+     *  100x64 viewport on a 128x64 display; the ILI9341 is 240x320.
+     */
+
+    G3DFrameBuffer fb(rgb ? G3D_FORMAT_RGB565 : G3D_FORMAT_MONO,
+                      rgb ? 240 : 128, rgb ? 320 : 64);
+
+    /*
+     *  With -bands n (built with G3D_BANDS set) we draw into a buffer
+     *  one band high, recording up to n segments a frame, and copy each
+     *  band into the full framebuffer after it is drawn.
+     */
+
+#if G3D_BANDS > 0
+    G3DFrameBuffer band(fb.format(),fb.width(),G3D_BANDHEIGHT(rgb ? 320 : 64));
+    G3D draw(bands ? band : fb,0,0,rgb ? 240 : 100,rgb ? 320 : 64);
+    std::vector<G3DBandSegment> bandBuffer(bands);
+    if (bands) draw.setBandBuffer(bandBuffer.data(),bands);
+    bool dropped = false;
+#else
+    G3D draw(fb,0,0,rgb ? 240 : 100,rgb ? 320 : 64);
+#endif
+    uint16_t color = rgb ? 0xF800 : 1;
+    if (dist <= 0) dist = 3.5f + (grid - 1) * 4.0f;
+
+    /*
+     *  Scene: a box grid, or a sphere with sphere segments around. With
+     *  -mesh the geometry goes through G3D::drawMesh with a mesh buffer;
+     *  with -solid it goes through G3D::drawSolidMesh, skipping the back;
+     *  with -batch the sphere is transformed with G3D::transformBatch,
+     *  or with -threads n (built with G3D_PARALLEL set) on n threads with
+     *  G3DParallel (0 for one per core).
+     *  With -lod px the sphere moves away and back through G3D::drawLODMesh
+     *  with a px pixel error; adding -govern fps draws it through a
+     *  G3DGovernor holding fps frames a second, which logs each change
+     *  of quality. Otherwise each edge endpoint is transformed as it is
+     *  drawn.
+     */
+
+    if (sphere) buildSphere(sphere);
+    uint32_t vertexCount = SphereVertices.size() / 3;
+
+    G3DMesh sphereMesh = { 0, 0, NULL, NULL };
+    G3DSolidMesh sphereSolid = { 0, 0, 0, NULL, NULL, NULL, NULL };
+    std::vector<uint16_t> meshEdges(SphereEdges.begin(),SphereEdges.end());
+    std::vector<G3DMeshVertex> meshBuffer;
+    std::vector<uint8_t> faceBuffer;
+    if (mesh || solid) {
+        if (vertexCount > 0xFFFF) {
+            fprintf(stderr,"Sphere too large for G3DMesh; use -batch\n");
+            return 1;
+        }
+        sphereMesh.vertexCount = vertexCount;
+        sphereMesh.edgeCount = meshEdges.size() / 2;
+        sphereMesh.vertices = SphereVertices.data();
+        sphereMesh.edges = meshEdges.data();
+
+        meshBuffer.resize(sphere ? vertexCount : 8);
+        draw.setMeshBuffer(meshBuffer.data(),meshBuffer.size());
+    }
+    G3DLODMesh sphereLOD = { 0, NULL, NULL, 0, 0, 0, 0 };
+    std::vector<long> lodFrames;
+    if (lod) {
+        buildSphereLOD(sphere);
+        sphereLOD.levelCount = LODLevels.size();
+        sphereLOD.levels = LODLevels.data();
+        sphereLOD.vertices = LODVertices.data();
+        sphereLOD.radius = 2;
+        lodFrames.resize(LODLevels.size() + 2);
+
+        meshBuffer.resize(vertexCount);
+        draw.setMeshBuffer(meshBuffer.data(),meshBuffer.size());
+    }
+    if (solid) {
+        if (sphere) buildSphereFaces(sphere);
+        sphereSolid.vertexCount = sphereMesh.vertexCount;
+        sphereSolid.edgeCount = sphereMesh.edgeCount;
+        sphereSolid.faceCount = SphereFaces.size() / 3;
+        sphereSolid.vertices = sphereMesh.vertices;
+        sphereSolid.edges = sphereMesh.edges;
+        sphereSolid.edgeFaces = SphereEdgeFaces.data();
+        sphereSolid.faces = SphereFaces.data();
+
+        faceBuffer.resize((std::max<size_t>(sphereSolid.faceCount,6) + 7) / 8);
+        draw.setFaceBuffer(faceBuffer.data(),faceBuffer.size());
+    }
+
+    /*
+     *  With -model a compact mesh is mapped from a file and drawn where
+     *  it lies, with a mesh buffer large enough for all its vertices.
+     */
+
+    const uint8_t *model = NULL;
+    size_t modelSize = 0;
+    long modelEdges = 0;
+    if (modelPath) {
+        model = mapModel(modelPath,modelSize);
+        if (model == NULL) {
+            fprintf(stderr,"Unable to map %s\n",modelPath);
+            return 1;
+        }
+        uint16_t count = model[6] | (model[7] << 8);
+        meshBuffer.resize(count);
+        draw.setMeshBuffer(meshBuffer.data(),meshBuffer.size());
+
+        size_t used = G3D_COMPACT_HEADER + 3 * count * ((model[4] & G3D_COMPACT_WORD) ? 2 : 1);
+        uint16_t strips = model[8] | (model[9] << 8);
+        uint16_t i = 0;
+        for (; (i < strips) && (used + 2 <= modelSize); ++i) {
+            uint16_t n = model[used] | (model[used + 1] << 8);
+            if (n > 1) modelEdges += n - 1;
+            used += 2 + n * ((model[4] & G3D_COMPACT_WIDEINDEX) ? 2 : 1);
+        }
+        if ((i < strips) || (used > modelSize)) {
+            fprintf(stderr,"%s is truncated\n",modelPath);
+            return 1;
+        }
+    }
+
+    /*
+     *  With -instance the box grid is drawn with one call to
+     *  G3D::drawInstances, which needs room for two copies of the box.
+     */
+
+    std::vector<G3DScalar> offsets;
+    if (instance) {
+        int start = -(grid - 1) * 2;
+        for (int i = 0; i < grid; ++i) {
+            for (int j = 0; j < grid; ++j) {
+                offsets.push_back(start + i * 4);
+                offsets.push_back(start + j * 4);
+                offsets.push_back(0);
+            }
+        }
+        meshBuffer.resize(16);
+        draw.setMeshBuffer(meshBuffer.data(),meshBuffer.size());
+    }
+
+    std::vector<G3DScalar> soa[3];
+    std::vector<G3DScalar> tsoa[4];
+    std::vector<uint8_t> outcodes(vertexCount);
+    G3DBatch sphereBatch;
+    if (batch) {
+        for (int i = 0; i < 3; ++i) {
+            for (uint32_t j = 0; j < vertexCount; ++j) {
+                soa[i].push_back(SphereVertices[3*j+i]);
+            }
+        }
+        for (int i = 0; i < 4; ++i) tsoa[i].resize(vertexCount);
+        sphereBatch.count = vertexCount;
+        sphereBatch.x = tsoa[0].data();
+        sphereBatch.y = tsoa[1].data();
+        sphereBatch.z = tsoa[2].data();
+        sphereBatch.w = tsoa[3].data();
+        sphereBatch.outcode = outcodes.data();
+    }
+#if G3D_PARALLEL
+    G3DParallel parallel(threads);
+#endif
+
+    /*
+     *  With -list the box grid is recorded into a display list once and
+     *  replayed each frame.
+     */
+
+    std::vector<uint8_t> listOps(G3D_LIST_OPBYTES(16L * grid * grid));
+    std::vector<G3DScalar> listVertices(3 * 16L * grid * grid);
+    G3DDisplayList displayList(listOps.data(),listVertices.data(),16L * grid * grid);
+    if (list) {
+        int start = -(grid - 1) * 2;
+        for (int i = 0; i < grid; ++i) {
+            for (int j = 0; j < grid; ++j) {
+                drawBox(displayList,start + i * 4,start + j * 4,0);
+            }
+        }
+    }
+
+    long edges = sphere ? (long)SphereEdges.size() / 2 : 12L * grid * grid;
+    if (model) edges = modelEdges;
+    if (fill) edges = rgb ? 2L * (240 + 320) : 2L * (100 + 64);
+
+    GXAngle = 0;
+    GYAngle = 0;
+
+    /*
+     *  With -erase n, rather than clearing the framebuffer each frame we
+     *  record up to n segments and erase them with G3D::erase, then
+     *  check that nothing was left behind.
+     */
+
+    std::vector<G3DSegment> damage(erase);
+    if (erase) draw.setDamageBuffer(damage.data(),erase);
+    long leftover = 0;
+    long pixels = 0;
+    long edgesDrawn = 0;
+
+    /*
+     *  With -flush each frame is sent to a counting display sink, so we
+     *  can compare the bytes sent with a full update of every frame.
+     */
+
+    CountingSink sink(fb.width(),fb.height());
+
+    G3DGovernor governor(govern ? govern : 1);
+    governor.setPixels(lod);
+    long qualityFrames[G3D_QUALITYWORST + 1] = { 0 };
+    long overBudget = 0;
+
+    std::chrono::steady_clock::duration total(0);
+    std::chrono::steady_clock::duration eraseTotal(0);
+#if G3D_STATS > 0
+    G3DStats stats;
+    memset(&stats,0,sizeof(stats));
+#endif
+    for (int i = 0; i < frames; ++i) {
+#if G3D_STATS > 0
+        draw.clearStats();
+#endif
+        if (erase) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            draw.begin();
+            draw.erase(0);
+            draw.end();
+            eraseTotal += std::chrono::steady_clock::now() - start;
+
+            for (int y = 0; y < fb.height(); ++y) {
+                for (int x = 0; x < fb.width(); ++x) {
+                    if (fb.getPixel(x,y)) ++leftover;
+                }
+            }
+        } else {
+            fb.clear();
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        draw.begin();
+        draw.setColor(color);
+        transform(draw,lod ? dist * (1 + 7.5f * (1 - cosf(i * 0.02f))) : dist);
+        if (model) {
+            if (!draw.drawCompactMesh(model,modelSize)) {
+                fprintf(stderr,"%s is not a compact mesh\n",modelPath);
+                return 1;
+            }
+        } else if (fill) {
+            pixels = drawFan(draw,rgb ? 240 : 100,rgb ? 320 : 64);
+#if G3D_PARALLEL
+        } else if (sphere && batch && (threads != 1)) {
+            parallel.transformBatch(draw,soa[0].data(),soa[1].data(),soa[2].data(),sphereBatch);
+            parallel.drawBatch(draw,sphereBatch,SphereEdges.size() / 2,SphereEdges.data());
+#endif
+        } else if (sphere && lod) {
+            uint8_t level;
+            if (govern) {
+                ++qualityFrames[governor.getState().quality];
+                governor.beginFrame();
+                level = governor.drawLODMesh(draw,sphereLOD);
+            } else {
+                level = draw.drawLODMesh(sphereLOD,lod);
+            }
+            if (level == G3D_LODCULLED) {
+                ++lodFrames[LODLevels.size()];
+            } else if (level == G3D_LODSKIPPED) {
+                ++lodFrames[LODLevels.size() + 1];
+            } else {
+                ++lodFrames[level];
+                edgesDrawn += LODLevels[level].edgeCount;
+            }
+        } else if (sphere && batch) {
+            draw.transformBatch(soa[0].data(),soa[1].data(),soa[2].data(),sphereBatch);
+            draw.drawBatch(sphereBatch,SphereEdges.size() / 2,SphereEdges.data());
+        } else if (sphere && solid) {
+            draw.drawSolidMesh(sphereSolid);
+        } else if (sphere && mesh) {
+            draw.drawMesh(sphereMesh);
+        } else if (sphere) {
+            drawSphere(draw);
+        } else if (instance) {
+            draw.drawInstances(CubeMesh,grid * grid,offsets.data());
+        } else {
+            drawScene(draw,grid,mesh,solid,cull,list ? &displayList : NULL);
+            draw.setClipping(true);
+        }
+        draw.end();
+        total += std::chrono::steady_clock::now() - start;
+
+        if (govern) {
+            if (governor.endFrame() > 1000000UL / govern) ++overBudget;
+            const G3DGovernorState &g = governor.getState();
+            if (g.change != G3D_GOVERNHOLD) {
+                printf("frame %d: %u us (predicted %u), %s quality %u: %.1f px, 1 in %u points, skip under %.0f px\n",
+                       i,g.frameTime,g.predicted,(g.change == G3D_GOVERNLOWER) ? "lower" : "raise",
+                       g.quality,g.lodPixels,g.pointStep,g.minRadius);
+            }
+        }
+
+#if G3D_BANDS > 0
+        if (bands) {
+            dropped |= draw.bandOverflow();
+            for (uint8_t b = 0; b < G3D_BANDS; ++b) {
+                start = std::chrono::steady_clock::now();
+                band.clear();
+                draw.drawBand(b);
+                total += std::chrono::steady_clock::now() - start;
+
+                uint16_t top = b * draw.bandHeight();
+                if (flush) band.flushPages(sink,top / 8);
+                for (int y = 0; (y < band.height()) && (top + y < fb.height()); ++y) {
+                    for (int x = 0; x < band.width(); ++x) {
+                        fb.drawPixel(x,top + y,band.getPixel(x,y));
+                    }
+                }
+            }
+        } else if (flush) {
+            fb.flush(sink);
+        }
+#else
+        if (flush) fb.flush(sink);
+#endif
+
+#if G3D_STATS > 0
+        /*
+         *  Gather each frame's statistics
+         */
+
+        const G3DStats &frame = draw.getStats();
+        stats.vertices += frame.vertices;
+        stats.accepted += frame.accepted;
+        stats.rejected += frame.rejected;
+        stats.clipped += frame.clipped;
+        stats.guardBand += frame.guardBand;
+        stats.divisions += frame.divisions;
+        stats.lines += frame.lines;
+        stats.points += frame.points;
+        stats.pixels += frame.pixels;
+#if G3D_STATS > 1
+        for (int j = 0; j < 4; ++j) stats.time[j] += frame.time[j];
+#endif
+#endif
+
+        GXAngle += 0.01;
+        GYAngle += 0.02;
+    }
+
+    double us = std::chrono::duration<double,std::micro>(total).count();
+    printf("%d frames, %ld edges/frame: %.3f us/frame, %.1f ns/edge\n",
+           frames,edges,us / frames,us * 1000.0 / ((double)frames * edges));
+#if G3D_STATS > 0
+    printf("stats/frame: %.1f vertices, %.1f accepted, %.1f rejected, %.1f clipped, %.1f guard band, %.1f divisions, %.1f lines, %.1f points, %.1f pixels\n",
+           (double)stats.vertices / frames,(double)stats.accepted / frames,(double)stats.rejected / frames,
+           (double)stats.clipped / frames,(double)stats.guardBand / frames,(double)stats.divisions / frames,
+           (double)stats.lines / frames,(double)stats.points / frames,(double)stats.pixels / frames);
+#if G3D_STATS > 1
+    printf("time/frame: stage 4 %.3f us, stage 3 %.3f us, stage 2 %.3f us, stage 1 %.3f us\n",
+           (double)stats.time[3] / G3D_TICKSPERUS / frames,(double)stats.time[2] / G3D_TICKSPERUS / frames,
+           (double)stats.time[1] / G3D_TICKSPERUS / frames,(double)stats.time[0] / G3D_TICKSPERUS / frames);
+#endif
+#endif
+    if (lod) {
+        printf("lod: %.1f edges/frame;",(double)edgesDrawn / frames);
+        for (size_t i = 0; i < LODLevels.size(); ++i) {
+            printf(" level %zu (%u edges, error %.3f) %ld frames,",i,LODLevels[i].edgeCount,
+                   G3DToFloat(LODLevels[i].error),lodFrames[i]);
+        }
+        printf(" culled %ld frames, skipped %ld frames\n",lodFrames[LODLevels.size()],lodFrames[LODLevels.size() + 1]);
+    }
+    if (govern) {
+        printf("govern: %d fps, %ld frames over budget, %.3f us per vertex or segment; frames at quality",
+               govern,overBudget,governor.getState().unitCost);
+        for (int q = 0; q <= G3D_QUALITYWORST; ++q) printf(" %d: %ld%s",q,qualityFrames[q],(q < G3D_QUALITYWORST) ? "," : "\n");
+    }
+    if (fill) {
+        printf("fill: %ld pixels/frame, %.1f pixels/us\n",pixels,pixels * (double)frames / us);
+    }
+#if G3D_BANDS > 0
+    if (bands) {
+        printf("bands: %d bands of %u rows, %u byte band buffer, %u byte segment buffer%s\n",
+               G3D_BANDS,draw.bandHeight(),band.bufferSize(),(unsigned)(bands * sizeof(G3DBandSegment)),
+               dropped ? ", segments dropped" : "");
+    }
+#endif
+    if (erase) {
+        us = std::chrono::duration<double,std::micro>(eraseTotal).count();
+        printf("erase: %.3f us/frame, %ld pixels left behind\n",us / frames,leftover);
+    }
+
+    if (flush) {
+        long mismatch = 0;
+        for (uint32_t i = 0; i < fb.bufferSize(); ++i) {
+            if (sink.display[i] != fb.getBuffer()[i]) ++mismatch;
+        }
+        printf("flush: %.1f data bytes/frame (full update %u), %.1f command bytes/frame, %.1f transfers/frame, %ld bytes differ\n",
+               (double)sink.dataBytes / frames,fb.bufferSize(),
+               (double)sink.commandBytes / frames,(double)sink.transfers / frames,mismatch);
+    }
+
+    if (output && !writeImage(fb,output)) {
+        fprintf(stderr,"Unable to write %s\n",output);
+        return 1;
+    }
+    return 0;
+}
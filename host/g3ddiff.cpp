@@ -0,0 +1,682 @@
+/*  g3ddiff.cpp
+ *
+ *      Differential test of the G3D pipeline. Stages 4 through 2 are
+ *  reimplemented here in double precision, and segments are run through
+ *  both; we report how far the endpoints G3D hands to stage 1 are from
+ *  the reference, and any segments one draws and the other does not.
+ *  Build with USELIBRARY=3 and whatever options are being measured
+ *  (G3DSCALAR, G3DTRIG, G3D_GUARDBAND); see README.md.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include "G3D.h"
+
+#if USELIBRARY != 3
+#error The desktop build requires USELIBRARY=3
+#endif
+
+/********************************************************************/
+/*                                                                  */
+/*  Reference Pipeline												*/
+/*                                                                  */
+/********************************************************************/
+
+/*	RefMatrix
+ *
+ *		A double precision G3DMatrix, built the same way: each new
+ *	transformation is multiplied in on the right.
+ */
+
+struct RefMatrix {
+    double a[4][4];
+
+    void    setIdentity()
+                {
+                    for (int i = 0; i < 4; ++i) {
+                        for (int j = 0; j < 4; ++j) a[i][j] = (i == j) ? 1 : 0;
+                    }
+                }
+    void    multiply(const RefMatrix &m)
+                {
+                    double t[4][4];
+                    for (int i = 0; i < 4; ++i) {
+                        for (int j = 0; j < 4; ++j) {
+                            t[i][j] = 0;
+                            for (int k = 0; k < 4; ++k) t[i][j] += a[i][k] * m.a[k][j];
+                        }
+                    }
+                    memcpy(a,t,sizeof(a));
+                }
+    void    translate(double x, double y, double z)
+                {
+                    RefMatrix m;
+                    m.setIdentity();
+                    m.a[0][3] = x;
+                    m.a[1][3] = y;
+                    m.a[2][3] = z;
+                    multiply(m);
+                }
+    void    scale(double x, double y, double z)
+                {
+                    RefMatrix m;
+                    m.setIdentity();
+                    m.a[0][0] = x;
+                    m.a[1][1] = y;
+                    m.a[2][2] = z;
+                    multiply(m);
+                }
+    void    rotate(int axis, double angle)
+                {
+                    double c = cos(angle);
+                    double s = sin(angle);
+                    RefMatrix m;
+                    m.setIdentity();
+                    switch (axis) {
+                        case AXIS_X:
+                            m.a[1][1] = c;
+                            m.a[2][2] = c;
+                            m.a[1][2] = -s;
+                            m.a[2][1] = s;
+                            break;
+                        case AXIS_Y:
+                            m.a[0][0] = c;
+                            m.a[2][2] = c;
+                            m.a[0][2] = s;
+                            m.a[2][0] = -s;
+                            break;
+                        case AXIS_Z:
+                            m.a[0][0] = c;
+                            m.a[1][1] = c;
+                            m.a[0][1] = s;
+                            m.a[1][0] = -s;
+                            break;
+                    }
+                    multiply(m);
+                }
+    void    perspective(double fov, double near)
+                {
+                    RefMatrix m;
+                    m.setIdentity();
+                    m.a[0][0] = fov;
+                    m.a[1][1] = fov;
+                    m.a[2][2] = 0;
+                    m.a[3][3] = 0;
+                    m.a[2][3] = -1;
+                    m.a[3][2] = -near;
+                    multiply(m);
+                }
+};
+
+struct RefVector {
+    double x, y, z, w;
+};
+
+/*	RefPipeline
+ *
+ *		Stages 4 through 2 of G3D in double precision: transform,
+ *	clip with Liang-Barsky against the same walls, and map to the same
+ *	screen coordinates, without rounding.
+ */
+
+class RefPipeline
+{
+    public:
+        RefMatrix transformation;
+
+                RefPipeline(uint16_t width, uint16_t height)
+                    {
+                        double w1 = width - 1;
+                        double h1 = height - 1;
+                        xsize = (w1 > h1) ? 1 : w1 / h1;
+                        ysize = (w1 > h1) ? h1 / w1 : 1;
+                        xscale = w1 / 2;
+                        yscale = h1 / 2;
+                        xoff = width / 2.0;
+                        yoff = height / 2.0;
+                        transformation.setIdentity();
+                    }
+
+        void    perspective(double fov, double near)
+                    {
+                        transformation.perspective(fov,near);
+                        transformation.scale(1 / xsize,1 / ysize,1);
+                    }
+
+        bool    segment(const double *p0, const double *p1, double out[4]) const;
+
+    private:
+        double  xsize, ysize;
+        double  xscale, yscale;
+        double  xoff, yoff;
+
+        void    transform(const double *p, RefVector &v) const
+                    {
+                        const double (*a)[4] = transformation.a;
+                        v.x = a[0][0] * p[0] + a[0][1] * p[1] + a[0][2] * p[2] + a[0][3];
+                        v.y = a[1][0] * p[0] + a[1][1] * p[1] + a[1][2] * p[2] + a[1][3];
+                        v.z = a[2][0] * p[0] + a[2][1] * p[1] + a[2][2] * p[2] + a[2][3];
+                        v.w = a[3][0] * p[0] + a[3][1] * p[1] + a[3][2] * p[2] + a[3][3];
+                    }
+        void    screen(const RefVector &v, double *out) const
+                    {
+                        out[0] = xoff + v.x / v.w * xscale;
+                        out[1] = yoff - v.y / v.w * yscale;
+                    }
+};
+
+static uint8_t RefOutCode(const RefVector &v)
+{
+    uint8_t m = 0;
+
+    if (v.x < -v.w) m |= 1;
+    if (v.x > v.w) m |= 2;
+    if (v.y < -v.w) m |= 4;
+    if (v.y > v.w) m |= 8;
+    if (v.z < -v.w) m |= 16;
+    if (v.z > 0) m |= 32;
+
+    return m;
+}
+
+/*	RefPipeline::segment
+ *
+ *		Clip the segment p0 to p1, returning false if none of it is
+ *	visible, or its ends in screen coordinates in out.
+ */
+
+bool RefPipeline::segment(const double *p0, const double *p1, double out[4]) const
+{
+    RefVector a, b;
+    transform(p0,a);
+    transform(p1,b);
+
+    uint8_t ca = RefOutCode(a);
+    uint8_t cb = RefOutCode(b);
+    if (ca & cb) return false;
+
+    double aold = 0;
+    double anew = 1;
+    uint8_t mask = ca | cb;
+    for (int i = 0; i < 6; ++i) {
+        if (!(mask & (1 << i))) continue;
+
+        double da, db;
+        switch (i) {
+            default:
+            case 0: da = a.x + a.w; db = b.x + b.w; break;
+            case 1: da = -a.x + a.w; db = -b.x + b.w; break;
+            case 2: da = a.y + a.w; db = b.y + b.w; break;
+            case 3: da = -a.y + a.w; db = -b.y + b.w; break;
+            case 4: da = a.z + a.w; db = b.z + b.w; break;
+            case 5: da = a.z; db = b.z; break;
+        }
+        double alpha = da / (da - db);
+        if (ca & (1 << i)) {
+            aold = std::max(aold,alpha);
+        } else {
+            anew = std::min(anew,alpha);
+        }
+        if (aold > anew) return false;
+    }
+
+    RefVector c;
+    c.x = a.x + aold * (b.x - a.x);
+    c.y = a.y + aold * (b.y - a.y);
+    c.w = a.w + aold * (b.w - a.w);
+    screen(c,out);
+    c.x = a.x + anew * (b.x - a.x);
+    c.y = a.y + anew * (b.y - a.y);
+    c.w = a.w + anew * (b.w - a.w);
+    screen(c,out + 2);
+    return true;
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Comparison														*/
+/*                                                                  */
+/********************************************************************/
+
+/*	Camera
+ *
+ *		The demo's camera and object transformation, applied to both
+ *	pipelines
+ */
+
+struct Camera {
+    double  dist;
+    double  xangle;
+    double  yangle;
+};
+
+static void setCamera(G3D &draw, RefPipeline &ref, const Camera &c)
+{
+    draw.transformation.setIdentity();
+    draw.perspective(1.0f,0.5f);
+    draw.translate(0,0,-c.dist);
+    draw.rotate(AXIS_X,c.xangle);
+    draw.rotate(AXIS_Y,c.yangle);
+
+    ref.transformation.setIdentity();
+    ref.perspective(1.0,0.5);
+    ref.transformation.translate(0,0,-c.dist);
+    ref.transformation.rotate(AXIS_X,(float)c.xangle);
+    ref.transformation.rotate(AXIS_Y,(float)c.yangle);
+}
+
+/*	Results
+ *
+ *		Endpoint errors and visibility disagreements for one workload
+ */
+
+struct Results {
+    long    segments;
+    long    visible;        // drawn by both
+    long    onlyG3D;        // drawn only by G3D
+    long    onlyRef;        // drawn only by the reference
+    long    endpoints;
+    long    moved;          // endpoints not on the reference's pixel
+    long    moved2;         // endpoints 2 or more pixels away
+    double  maxError;
+    double  totalError;
+};
+
+static bool GVerbose = false;
+static int GReported = 0;
+
+/*	compare
+ *
+ *		Draw the segment g0 to g1 with G3D, capturing what reaches stage
+ *	1 with the damage buffer, and the segment p0 to p1 (the same segment,
+ *	unless G3D is given quantized vertices) with the reference. G3D's
+ *	screen coordinates are whole pixels, so we compare them with the
+ *	pixel the reference lands in.
+ */
+
+static void compare(G3D &draw, G3DSegment *damage, const RefPipeline &ref,
+                    const double *g0, const double *g1, const double *p0, const double *p1, Results &r)
+{
+    damage[0].x1 = 0xFFFF;
+    draw.clearDamage();
+    draw.begin();
+    draw.move(G3DScalar((float)g0[0]),G3DScalar((float)g0[1]),G3DScalar((float)g0[2]));
+    draw.draw(G3DScalar((float)g1[0]),G3DScalar((float)g1[1]),G3DScalar((float)g1[2]));
+    draw.end();
+    bool drawn = (damage[0].x1 != 0xFFFF);
+
+    double out[4];
+    bool visible = ref.segment(p0,p1,out);
+
+    ++r.segments;
+    if (drawn != visible) {
+        if (drawn) ++r.onlyG3D; else ++r.onlyRef;
+        if (GVerbose && (GReported++ < 20)) {
+            printf("    (%g,%g,%g)-(%g,%g,%g) drawn only by %s\n",p0[0],p0[1],p0[2],p1[0],p1[1],p1[2],
+                   drawn ? "G3D" : "the reference");
+        }
+        return;
+    }
+    if (!drawn) return;
+
+    ++r.visible;
+    uint16_t g[4] = { damage[0].x1, damage[0].y1, damage[0].x2, damage[0].y2 };
+    for (int i = 0; i < 4; i += 2) {
+        double dx = g[i] - floor(out[i]);
+        double dy = g[i+1] - floor(out[i+1]);
+        double e = sqrt(dx * dx + dy * dy);
+
+        ++r.endpoints;
+        r.totalError += e;
+        if (e > 0) ++r.moved;
+        if (e >= 2) ++r.moved2;
+        if (e > r.maxError) {
+            r.maxError = e;
+            if (GVerbose && (GReported++ < 20)) {
+                printf("    (%g,%g,%g)-(%g,%g,%g) end %d at (%d,%d), reference (%.2f,%.2f)\n",
+                       p0[0],p0[1],p0[2],p1[0],p1[1],p1[2],i / 2,g[i],g[i+1],out[i],out[i+1]);
+            }
+        }
+    }
+}
+
+static void report(const char *name, const Results &r)
+{
+    printf("%-8s %8ld segments %8ld drawn; endpoint error max %.2f px, mean %.4f px, %ld off by 1+ px, %ld by 2+ px; "
+           "drawn only by G3D %ld, only by reference %ld\n",
+           name,r.segments,r.visible,r.maxError,r.endpoints ? r.totalError / r.endpoints : 0.0,
+           r.moved,r.moved2,r.onlyG3D,r.onlyRef);
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Workloads														*/
+/*                                                                  */
+/********************************************************************/
+
+/*	Random
+ *
+ *		A small xorshift generator, so the workloads are the same on
+ *	every machine
+ */
+
+class Random
+{
+    public:
+                Random(uint32_t seed)
+                    {
+                        state = seed;
+                    }
+
+        double  uniform(double lo, double hi)
+                    {
+                        state ^= state << 13;
+                        state ^= state >> 17;
+                        state ^= state << 5;
+                        return lo + (hi - lo) * (state >> 8) / 16777216.0;
+                    }
+
+    private:
+        uint32_t state;
+};
+
+/*
+ *  A mesh: vertices, and pairs of indexes for the edges
+ */
+
+struct Mesh {
+    std::vector<double> vertices;
+    std::vector<uint32_t> edges;
+};
+
+/*	buildGrid
+ *
+ *		The demo's grid of boxes
+ */
+
+static void buildGrid(Mesh &m, int size)
+{
+    static const uint32_t edges[] = {
+        0,1, 1,2, 2,3, 3,0, 0,4, 4,5, 5,6, 6,7, 7,4, 1,5, 2,6, 3,7
+    };
+    int start = -(size - 1) * 2;
+    for (int i = 0; i < size; ++i) {
+        for (int j = 0; j < size; ++j) {
+            uint32_t base = m.vertices.size() / 3;
+            for (int k = 0; k < 8; ++k) {
+                m.vertices.push_back(start + i * 4 + ((k == 1) || (k == 2) || (k == 5) || (k == 6) ? 1 : -1));
+                m.vertices.push_back(start + j * 4 + ((k & 2) ? 1 : -1));
+                m.vertices.push_back((k & 4) ? 1 : -1);
+            }
+            for (int k = 0; k < 24; ++k) m.edges.push_back(base + edges[k]);
+        }
+    }
+}
+
+/*	buildSphere
+ *
+ *		The demo's latitude/longitude sphere of radius 2
+ */
+
+static void buildSphere(Mesh &m, int segs)
+{
+    int rings = segs / 2;
+    for (int r = 1; r < rings; ++r) {
+        double lat = M_PI * r / rings;
+        for (int s = 0; s < segs; ++s) {
+            double lon = 2 * M_PI * s / segs;
+            m.vertices.push_back(2 * sin(lat) * cos(lon));
+            m.vertices.push_back(2 * cos(lat));
+            m.vertices.push_back(2 * sin(lat) * sin(lon));
+        }
+    }
+    uint32_t north = m.vertices.size() / 3;
+    double poles[] = { 0,2,0, 0,-2,0 };
+    m.vertices.insert(m.vertices.end(),poles,poles + 6);
+
+    for (int r = 0; r < rings - 1; ++r) {
+        for (int s = 0; s < segs; ++s) {
+            uint32_t v = r * segs + s;
+            m.edges.push_back(v);
+            m.edges.push_back(r * segs + (s + 1) % segs);
+            m.edges.push_back(v);
+            m.edges.push_back((r == 0) ? north : v - segs);
+            if (r == rings - 2) {
+                m.edges.push_back(v);
+                m.edges.push_back(north + 1);
+            }
+        }
+    }
+}
+
+/*	readModel
+ *
+ *		Read the vertices and edges of an OBJ file or edge list
+ */
+
+static bool readModel(Mesh &m, const char *path)
+{
+    FILE *f = fopen(path,"r");
+    if (f == NULL) return false;
+
+    char line[1024];
+    while (fgets(line,sizeof(line),f)) {
+        char *tok = strtok(line," \t\r\n");
+        if (tok == NULL) continue;
+
+        if (!strcmp(tok,"v")) {
+            for (int i = 0; i < 3; ++i) {
+                char *c = strtok(NULL," \t\r\n");
+                m.vertices.push_back(c ? atof(c) : 0);
+            }
+        } else if (!strcmp(tok,"f") || !strcmp(tok,"l") || !strcmp(tok,"e")) {
+            std::vector<uint32_t> refs;
+            char *c;
+            long n = m.vertices.size() / 3;
+            while ((c = strtok(NULL," \t\r\n")) != NULL) {
+                long i = strtol(c,NULL,10);
+                if (i < 0) i += n + 1;
+                if ((i < 1) || (i > n)) {
+                    fclose(f);
+                    return false;
+                }
+                refs.push_back(i - 1);
+            }
+            for (size_t i = 1; i < refs.size(); ++i) {
+                m.edges.push_back(refs[i-1]);
+                m.edges.push_back(refs[i]);
+            }
+            if ((tok[0] == 'f') && (refs.size() > 2)) {
+                m.edges.push_back(refs.back());
+                m.edges.push_back(refs[0]);
+            }
+        }
+    }
+
+    fclose(f);
+    return true;
+}
+
+/*	quantize
+ *
+ *		Quantize the vertices as g3dmesh does for a compact mesh, to 8
+ *	or 16 bits with a single scale, and dequantize them as
+ *	G3D::drawCompactMesh does
+ */
+
+static std::vector<double> quantize(const std::vector<double> &v, int bits)
+{
+    double extent = 0;
+    for (size_t i = 0; i < v.size(); ++i) extent = std::max(extent,fabs(v[i]));
+    int limit = (bits == 8) ? 127 : 32767;
+    float scale = (extent > 0) ? (float)extent / limit : 1;
+
+    std::vector<double> q(v.size());
+    for (size_t i = 0; i < v.size(); ++i) {
+        long n = lround((float)v[i] / scale);
+        n = std::max(-(long)limit,std::min((long)limit,n));
+        q[i] = G3DToFloat(G3DScalar(n * scale));
+    }
+    return q;
+}
+
+/*	runMesh
+ *
+ *		Draw each edge of a mesh as a segment from a series of camera
+ *	positions, turning as the demo does. G3D is given the vertices g3d,
+ *	which may be quantized; the reference always has the originals.
+ */
+
+static void runMesh(G3D &draw, G3DSegment *damage, RefPipeline &ref, const Mesh &m,
+                    const std::vector<double> &g3d, int frames, double dist, Results &r)
+{
+    Camera c = { dist, 0, 0 };
+    for (int f = 0; f < frames; ++f) {
+        setCamera(draw,ref,c);
+        for (size_t i = 0; i < m.edges.size(); i += 2) {
+            uint32_t a = 3 * m.edges[i];
+            uint32_t b = 3 * m.edges[i+1];
+            compare(draw,damage,ref,&g3d[a],&g3d[b],&m.vertices[a],&m.vertices[b],r);
+        }
+
+        // Step through a spread of angles rather than creeping
+        c.xangle += 0.37;
+        c.yangle += 0.74;
+    }
+}
+
+/*	runRandom
+ *
+ *		Random segments in a box around the origin, seen from a series
+ *	of camera positions, some inside the near plane so segments cross
+ *	every wall. Half are short and half cross the box.
+ */
+
+static void runRandom(G3D &draw, G3DSegment *damage, RefPipeline &ref, long count, Results &r)
+{
+    Random rnd(12345);
+    Camera c = { 4, 0, 0 };
+    for (long i = 0; i < count; ++i) {
+        if ((i % 1000) == 0) {
+            c.dist = rnd.uniform(0.5,8);
+            c.xangle = rnd.uniform(0,2 * M_PI);
+            c.yangle = rnd.uniform(0,2 * M_PI);
+            setCamera(draw,ref,c);
+        }
+
+        double p0[3], p1[3];
+        for (int j = 0; j < 3; ++j) {
+            p0[j] = rnd.uniform(-4,4);
+            p1[j] = (i & 1) ? p0[j] + rnd.uniform(-0.5,0.5) : rnd.uniform(-4,4);
+        }
+        compare(draw,damage,ref,p0,p1,p0,p1,r);
+    }
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Main															*/
+/*                                                                  */
+/********************************************************************/
+
+static void usage()
+{
+    fprintf(stderr,"usage: g3ddiff [-rgb] [-random n] [-frames n] [-model file [-quantize 8|16]] [-limit px] [-v]\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    bool rgb = false;
+    long random = 100000;
+    int frames = 64;
+    const char *modelPath = NULL;
+    int quantize = 0;
+    double limit = -1;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i],"-rgb")) {
+            rgb = true;
+        } else if (!strcmp(argv[i],"-random") && (i+1 < argc)) {
+            random = atol(argv[++i]);
+        } else if (!strcmp(argv[i],"-frames") && (i+1 < argc)) {
+            frames = atoi(argv[++i]);
+        } else if (!strcmp(argv[i],"-model") && (i+1 < argc)) {
+            modelPath = argv[++i];
+        } else if (!strcmp(argv[i],"-quantize") && (i+1 < argc)) {
+            quantize = atoi(argv[++i]);
+        } else if (!strcmp(argv[i],"-limit") && (i+1 < argc)) {
+            limit = atof(argv[++i]);
+        } else if (!strcmp(argv[i],"-v")) {
+            GVerbose = true;
+        } else {
+            usage();
+        }
+    }
+    if ((random < 0) || (frames < 1) || (quantize && (quantize != 8) && (quantize != 16))) usage();
+
+    /*
+     *  The same displays as the demo
+     */
+
+    uint16_t width = rgb ? 240 : 100;
+    uint16_t height = rgb ? 320 : 64;
+    G3DFrameBuffer fb(rgb ? G3D_FORMAT_RGB565 : G3D_FORMAT_MONO,rgb ? 240 : 128,height);
+    G3D draw(fb,0,0,width,height);
+    draw.setColor(1);
+    G3DSegment damage[4];
+    draw.setDamageBuffer(damage,4);
+    RefPipeline ref(width,height);
+
+    double worst = 0;
+    Results r;
+
+    if (random) {
+        memset(&r,0,sizeof(r));
+        runRandom(draw,damage,ref,random,r);
+        report("random",r);
+        worst = std::max(worst,r.maxError);
+    }
+
+    Mesh grid;
+    buildGrid(grid,3);
+    memset(&r,0,sizeof(r));
+    runMesh(draw,damage,ref,grid,grid.vertices,frames,3.5,r);
+    runMesh(draw,damage,ref,grid,grid.vertices,frames,11.5,r);
+    report("grid",r);
+    worst = std::max(worst,r.maxError);
+
+    Mesh sphere;
+    buildSphere(sphere,24);
+    memset(&r,0,sizeof(r));
+    runMesh(draw,damage,ref,sphere,sphere.vertices,frames,2.5,r);
+    runMesh(draw,damage,ref,sphere,sphere.vertices,frames,6,r);
+    report("sphere",r);
+    worst = std::max(worst,r.maxError);
+
+    if (modelPath) {
+        Mesh model;
+        if (!readModel(model,modelPath)) {
+            fprintf(stderr,"Unable to read %s\n",modelPath);
+            return 1;
+        }
+
+        // Fit the model in a radius 2 sphere, like the sphere
+        double extent = 0;
+        for (size_t i = 0; i < model.vertices.size(); ++i) extent = std::max(extent,fabs(model.vertices[i]));
+        for (size_t i = 0; i < model.vertices.size(); ++i) model.vertices[i] *= (extent > 0) ? 2 / extent : 1;
+
+        std::vector<double> g3d = quantize ? ::quantize(model.vertices,quantize) : model.vertices;
+        memset(&r,0,sizeof(r));
+        runMesh(draw,damage,ref,model,g3d,frames,3,r);
+        runMesh(draw,damage,ref,model,g3d,frames,6,r);
+        report("model",r);
+        worst = std::max(worst,r.maxError);
+    }
+
+    return ((limit >= 0) && (worst > limit)) ? 1 : 0;
+}
@@ -0,0 +1,455 @@
+/*  g3dlod.cpp
+ *
+ *      Build the levels of detail of a wireframe model for
+ *  G3D::drawLODMesh (see G3DMesh.h). Reads Wavefront OBJ files (v, f and
+ *  l statements) and simple edge lists ("e a b"), as g3dmesh does, and
+ *  writes C source for a G3DLODMesh.
+ *
+ *      Each level is made from the one before by vertex clustering: the
+ *  vertices are sorted into a grid of cubes, each cube's vertices are
+ *  merged into the one nearest their average, and edges which collapse
+ *  or duplicate another are dropped. The grid is twice as coarse at each
+ *  level. Since every level's vertices are some of the last level's, we
+ *  can order them so each level uses the start of one shared array.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+/********************************************************************/
+/*                                                                  */
+/*  Model															*/
+/*                                                                  */
+/********************************************************************/
+
+typedef std::pair<uint32_t,uint32_t> Edge;
+
+static std::vector<float> Vertices;                         // x,y,z triplets
+static std::vector<Edge> Edges;                             // lower index first
+static std::set<Edge> EdgeSet;
+
+/*	addEdge
+ *
+ *		Record an edge, ignoring duplicates (faces share their edges)
+ */
+
+static void addEdge(uint32_t a, uint32_t b)
+{
+    if (a == b) return;
+    Edge e(std::min(a,b),std::max(a,b));
+    if (EdgeSet.insert(e).second) Edges.push_back(e);
+}
+
+/*	parseIndex
+ *
+ *		Parse an OBJ vertex reference (1 based, negative relative to the
+ *	end, with optional /texture/normal indexes) into a 0 based index
+ */
+
+static bool parseIndex(const char *tok, uint32_t &index)
+{
+    long i = strtol(tok,NULL,10);
+    long n = Vertices.size() / 3;
+    if (i < 0) i += n + 1;
+    if ((i < 1) || (i > n)) return false;
+    index = i - 1;
+    return true;
+}
+
+/*	readModel
+ *
+ *		Read an OBJ file or edge list. Points have no edges to simplify,
+ *	so they are ignored.
+ */
+
+static bool readModel(const char *path)
+{
+    FILE *f = fopen(path,"r");
+    if (f == NULL) return false;
+
+    char line[1024];
+    int lineno = 0;
+    while (fgets(line,sizeof(line),f)) {
+        ++lineno;
+        char *tok = strtok(line," \t\r\n");
+        if ((tok == NULL) || (tok[0] == '#')) continue;
+
+        if (!strcmp(tok,"v")) {
+            for (int i = 0; i < 3; ++i) {
+                char *c = strtok(NULL," \t\r\n");
+                Vertices.push_back(c ? atof(c) : 0);
+            }
+        } else if (!strcmp(tok,"f") || !strcmp(tok,"l") || !strcmp(tok,"e")) {
+            std::vector<uint32_t> refs;
+            char *c;
+            while ((c = strtok(NULL," \t\r\n")) != NULL) {
+                uint32_t index;
+                if (!parseIndex(c,index)) {
+                    fprintf(stderr,"%s:%d: bad vertex index %s\n",path,lineno,c);
+                    fclose(f);
+                    return false;
+                }
+                refs.push_back(index);
+            }
+
+            for (size_t i = 1; i < refs.size(); ++i) addEdge(refs[i-1],refs[i]);
+            if ((tok[0] == 'f') && (refs.size() > 2)) addEdge(refs.back(),refs[0]);
+        }
+    }
+
+    fclose(f);
+    return true;
+}
+
+static float distance(uint32_t a, uint32_t b)
+{
+    float dx = Vertices[3*a] - Vertices[3*b];
+    float dy = Vertices[3*a+1] - Vertices[3*b+1];
+    float dz = Vertices[3*a+2] - Vertices[3*b+2];
+    return sqrtf(dx * dx + dy * dy + dz * dz);
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Simplification													*/
+/*                                                                  */
+/********************************************************************/
+
+/*
+ *  A level: the vertices it keeps, where each vertex of the full model
+ *  went, its edges, and its error
+ */
+
+struct Level {
+    std::vector<uint32_t> vertices;     // indexes into Vertices
+    std::vector<uint32_t> rep;          // for each vertex of the model
+    std::vector<Edge> edges;
+    float   error;
+};
+
+/*	cluster
+ *
+ *		Make the next level from prev by clustering its vertices in a
+ *	grid of cubes of the given size, starting at min
+ */
+
+static void cluster(const Level &prev, const float *min, float size, Level &next)
+{
+    /*
+     *  Sort the vertices into cells, and find the average of each cell
+     */
+
+    std::map<uint64_t,std::vector<uint32_t> > cells;
+    for (size_t i = 0; i < prev.vertices.size(); ++i) {
+        uint32_t v = prev.vertices[i];
+        uint64_t key = 0;
+        for (int j = 0; j < 3; ++j) {
+            key = (key << 21) | (uint64_t)((Vertices[3*v+j] - min[j]) / size);
+        }
+        cells[key].push_back(v);
+    }
+
+    /*
+     *  Each cell's vertices merge into the one nearest the average
+     */
+
+    std::vector<uint32_t> merge(Vertices.size() / 3,0xFFFFFFFF);
+    for (std::map<uint64_t,std::vector<uint32_t> >::const_iterator c = cells.begin(); c != cells.end(); ++c) {
+        const std::vector<uint32_t> &members = c->second;
+        float avg[3] = { 0, 0, 0 };
+        for (size_t i = 0; i < members.size(); ++i) {
+            for (int j = 0; j < 3; ++j) avg[j] += Vertices[3*members[i]+j] / members.size();
+        }
+
+        uint32_t best = members[0];
+        float bestDist = 0;
+        for (size_t i = 0; i < members.size(); ++i) {
+            float d = 0;
+            for (int j = 0; j < 3; ++j) {
+                float t = Vertices[3*members[i]+j] - avg[j];
+                d += t * t;
+            }
+            if ((i == 0) || (d < bestDist)) {
+                best = members[i];
+                bestDist = d;
+            }
+        }
+
+        next.vertices.push_back(best);
+        for (size_t i = 0; i < members.size(); ++i) merge[members[i]] = best;
+    }
+    std::sort(next.vertices.begin(),next.vertices.end());
+
+    /*
+     *  Follow each model vertex to where it is now, and measure how far
+     *  it moved in all
+     */
+
+    next.error = 0;
+    next.rep.resize(prev.rep.size());
+    for (size_t i = 0; i < prev.rep.size(); ++i) {
+        if (prev.rep[i] == 0xFFFFFFFF) {
+            next.rep[i] = 0xFFFFFFFF;
+            continue;
+        }
+        next.rep[i] = merge[prev.rep[i]];
+        next.error = std::max(next.error,distance(i,next.rep[i]));
+    }
+
+    std::set<Edge> seen;
+    for (size_t i = 0; i < prev.edges.size(); ++i) {
+        uint32_t a = merge[prev.edges[i].first];
+        uint32_t b = merge[prev.edges[i].second];
+        if (a == b) continue;
+        Edge e(std::min(a,b),std::max(a,b));
+        if (seen.insert(e).second) next.edges.push_back(e);
+    }
+}
+
+/*	chain
+ *
+ *		Order and orient edges so as many as possible continue from the
+ *	end of the one before, which G3D::drawMesh draws without a move. We
+ *	walk from each vertex of odd degree first, as every chain must start
+ *	or end at one, taking any unused edge until we are stuck.
+ */
+
+static std::vector<Edge> chain(const std::vector<Edge> &edges)
+{
+    std::map<uint32_t,std::vector<uint32_t> > adjacent;     // vertex to edges
+    for (size_t i = 0; i < edges.size(); ++i) {
+        adjacent[edges[i].first].push_back(i);
+        adjacent[edges[i].second].push_back(i);
+    }
+
+    std::vector<uint32_t> starts;
+    for (int pass = 0; pass < 2; ++pass) {
+        for (std::map<uint32_t,std::vector<uint32_t> >::const_iterator a = adjacent.begin(); a != adjacent.end(); ++a) {
+            if ((a->second.size() & 1) == (pass ? 0 : 1)) starts.push_back(a->first);
+        }
+    }
+
+    std::vector<bool> used(edges.size(),false);
+    std::vector<Edge> out;
+    for (size_t i = 0; i < starts.size(); ++i) {
+        uint32_t v = starts[i];
+        for (;;) {
+            std::vector<uint32_t> &list = adjacent[v];
+            while (!list.empty() && used[list.back()]) list.pop_back();
+            if (list.empty()) break;
+
+            uint32_t e = list.back();
+            used[e] = true;
+            uint32_t w = (edges[e].first == v) ? edges[e].second : edges[e].first;
+            out.push_back(Edge(v,w));
+            v = w;
+        }
+    }
+    return out;
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Output															*/
+/*                                                                  */
+/********************************************************************/
+
+/*	scalar
+ *
+ *		Format a value as a float literal, which also initializes a
+ *	fixed point G3DScalar
+ */
+
+static const char *scalar(float v, char *buf)
+{
+    char tmp[24];
+    snprintf(tmp,sizeof(tmp),"%.7g",v);
+    bool dot = (strpbrk(tmp,".e") != NULL);
+    snprintf(buf,32,"%s%sf",tmp,dot ? "" : ".0");
+    return buf;
+}
+
+/*	writeSource
+ *
+ *		Write the levels as C source. order maps each vertex of the
+ *	model to its place in the shared array.
+ */
+
+static void writeSource(FILE *f, const char *name, const char *input, const std::vector<Level> &levels,
+                        const std::vector<uint32_t> &vertices, const std::vector<uint32_t> &order,
+                        const float *center, float radius)
+{
+    char a[32], b[32], c[32], d[32];
+
+    fprintf(f,"// Levels of detail of %s; draw with G3D::drawLODMesh\n\n",input);
+    fprintf(f,"static const G3DScalar %sVertices[%zu] = {",name,vertices.size() * 3);
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        const float *v = &Vertices[3 * vertices[i]];
+        fprintf(f,"%s%s,%s,%s",(i % 4) ? ", " : (i ? ",\n    " : "\n    "),scalar(v[0],a),scalar(v[1],b),scalar(v[2],c));
+    }
+    fprintf(f,"\n};\n");
+
+    for (size_t l = 0; l < levels.size(); ++l) {
+        std::vector<Edge> edges = chain(levels[l].edges);
+        fprintf(f,"\nstatic const uint16_t %sEdges%zu[%zu] = {",name,l,edges.size() * 2);
+        for (size_t i = 0; i < edges.size(); ++i) {
+            fprintf(f,"%s%u,%u",(i % 8) ? ", " : (i ? ",\n    " : "\n    "),order[edges[i].first],order[edges[i].second]);
+        }
+        fprintf(f,"\n};\n");
+    }
+
+    fprintf(f,"\nstatic const G3DLODLevel %sLevels[%zu] = {\n",name,levels.size());
+    for (size_t l = 0; l < levels.size(); ++l) {
+        fprintf(f,"    { %zu, %zu, %sEdges%zu, %s }%s\n",levels[l].vertices.size(),levels[l].edges.size(),
+                name,l,scalar(levels[l].error,a),(l + 1 < levels.size()) ? "," : "");
+    }
+    fprintf(f,"};\n");
+
+    fprintf(f,"\nstatic const G3DLODMesh %s = { %zu, %sLevels, %sVertices, %s, %s, %s, %s };\n",
+            name,levels.size(),name,name,scalar(center[0],a),scalar(center[1],b),scalar(center[2],c),scalar(radius,d));
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Main															*/
+/*                                                                  */
+/********************************************************************/
+
+static void usage()
+{
+    fprintf(stderr,"usage: g3dlod [-levels n] [-cells n] [-c name] model.obj output.h\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int maxLevels = 4;
+    int cells = 32;
+    const char *name = "model";
+    const char *input = NULL;
+    const char *output = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i],"-levels") && (i+1 < argc)) {
+            maxLevels = atoi(argv[++i]);
+        } else if (!strcmp(argv[i],"-cells") && (i+1 < argc)) {
+            cells = atoi(argv[++i]);
+        } else if (!strcmp(argv[i],"-c") && (i+1 < argc)) {
+            name = argv[++i];
+        } else if (argv[i][0] == '-') {
+            usage();
+        } else if (input == NULL) {
+            input = argv[i];
+        } else if (output == NULL) {
+            output = argv[i];
+        } else {
+            usage();
+        }
+    }
+    if ((output == NULL) || (maxLevels < 1) || (maxLevels > 254) || (cells < 2)) usage();
+
+    if (!readModel(input)) {
+        fprintf(stderr,"Unable to read %s\n",input);
+        return 1;
+    }
+    if (Edges.empty()) {
+        fprintf(stderr,"%s has no edges\n",input);
+        return 1;
+    }
+
+    /*
+     *  Level 0 is the model itself, less any vertices with no edges.
+     *  Find its bounds and bounding sphere.
+     */
+
+    uint32_t n = Vertices.size() / 3;
+    std::vector<Level> levels(1);
+    Level &full = levels[0];
+    full.rep.assign(n,0xFFFFFFFF);
+    for (size_t i = 0; i < Edges.size(); ++i) {
+        full.rep[Edges[i].first] = Edges[i].first;
+        full.rep[Edges[i].second] = Edges[i].second;
+    }
+    for (uint32_t i = 0; i < n; ++i) {
+        if (full.rep[i] != 0xFFFFFFFF) full.vertices.push_back(i);
+    }
+    full.edges = Edges;
+    full.error = 0;
+    if (full.vertices.size() > 65535) {
+        fprintf(stderr,"%s has too many vertices for a G3DLODMesh\n",input);
+        return 1;
+    }
+
+    float min[3], max[3];
+    for (int j = 0; j < 3; ++j) {
+        min[j] = max[j] = Vertices[3 * full.vertices[0] + j];
+    }
+    for (size_t i = 0; i < full.vertices.size(); ++i) {
+        for (int j = 0; j < 3; ++j) {
+            min[j] = std::min(min[j],Vertices[3 * full.vertices[i] + j]);
+            max[j] = std::max(max[j],Vertices[3 * full.vertices[i] + j]);
+        }
+    }
+    float center[3], extent = 0;
+    for (int j = 0; j < 3; ++j) {
+        center[j] = (min[j] + max[j]) / 2;
+        extent = std::max(extent,max[j] - min[j]);
+    }
+    float radius = 0;
+    for (size_t i = 0; i < full.vertices.size(); ++i) {
+        const float *v = &Vertices[3 * full.vertices[i]];
+        float dx = v[0] - center[0];
+        float dy = v[1] - center[1];
+        float dz = v[2] - center[2];
+        radius = std::max(radius,sqrtf(dx * dx + dy * dy + dz * dz));
+    }
+    radius *= 1.0001f;          // so rounding in the output never leaves a vertex out
+
+    /*
+     *  Coarser levels, until one no longer saves much or the grid is a
+     *  single cube
+     */
+
+    for (int l = 1; (l < maxLevels) && (cells >= 2); ++l, cells /= 2) {
+        Level next;
+        cluster(levels.back(),min,(extent > 0) ? extent * 1.0001f / cells : 1,next);
+        if (next.edges.empty() || (next.edges.size() * 10 > levels.back().edges.size() * 9)) break;
+        levels.push_back(next);
+    }
+
+    /*
+     *  Order the vertices by the coarsest level which keeps them
+     */
+
+    std::vector<int> keep(n,-1);
+    for (size_t l = 0; l < levels.size(); ++l) {
+        for (size_t i = 0; i < levels[l].vertices.size(); ++i) keep[levels[l].vertices[i]] = l;
+    }
+    std::vector<uint32_t> vertices(levels[0].vertices);
+    std::stable_sort(vertices.begin(),vertices.end(),[&keep](uint32_t a, uint32_t b) { return keep[a] > keep[b]; });
+    std::vector<uint32_t> order(n,0xFFFFFFFF);
+    for (size_t i = 0; i < vertices.size(); ++i) order[vertices[i]] = i;
+
+    FILE *f = fopen(output,"w");
+    if (f == NULL) {
+        fprintf(stderr,"Unable to write %s\n",output);
+        return 1;
+    }
+    writeSource(f,name,input,levels,vertices,order,center,radius);
+    fclose(f);
+
+    fprintf(stderr,"bounding sphere (%g,%g,%g) radius %g\n",center[0],center[1],center[2],radius);
+    for (size_t l = 0; l < levels.size(); ++l) {
+        fprintf(stderr,"level %zu: %6zu vertices, %6zu edges, error %g\n",l,levels[l].vertices.size(),
+                levels[l].edges.size(),levels[l].error);
+    }
+    return 0;
+}
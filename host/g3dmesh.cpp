@@ -0,0 +1,408 @@
+/*  g3dmesh.cpp
+ *
+ *      Convert a wireframe model to the compact mesh format drawn by
+ *  G3D::drawCompactMesh (see G3DMesh.h). Reads Wavefront OBJ files
+ *  (v, f, l and p statements) and simple edge lists, which use the same
+ *  v statements with "e a b" for each edge. Writes either the binary
+ *  mesh, which the desktop build can map directly, or C source for a
+ *  PROGMEM array.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <set>
+#include <utility>
+#include <vector>
+#include "G3DMesh.h"
+
+/********************************************************************/
+/*                                                                  */
+/*  Model															*/
+/*                                                                  */
+/********************************************************************/
+
+static std::vector<float> Vertices;                         // x,y,z triplets
+static std::vector<std::pair<uint32_t,uint32_t> > Edges;    // in input order
+static std::set<std::pair<uint32_t,uint32_t> > EdgeSet;     // lower index first
+static std::vector<uint32_t> Points;
+
+/*	addEdge
+ *
+ *		Record an edge, ignoring duplicates (faces share their edges)
+ */
+
+static void addEdge(uint32_t a, uint32_t b)
+{
+    if (a == b) return;
+    if (EdgeSet.insert(std::make_pair(std::min(a,b),std::max(a,b))).second) {
+        Edges.push_back(std::make_pair(a,b));
+    }
+}
+
+/*	parseIndex
+ *
+ *		Parse an OBJ vertex reference (1 based, negative relative to the
+ *	end, with optional /texture/normal indexes) into a 0 based index
+ */
+
+static bool parseIndex(const char *tok, uint32_t &index)
+{
+    long i = strtol(tok,NULL,10);
+    long n = Vertices.size() / 3;
+    if (i < 0) i += n + 1;
+    if ((i < 1) || (i > n)) return false;
+    index = i - 1;
+    return true;
+}
+
+/*	readModel
+ *
+ *		Read an OBJ file or edge list
+ */
+
+static bool readModel(const char *path)
+{
+    FILE *f = fopen(path,"r");
+    if (f == NULL) return false;
+
+    char line[1024];
+    int lineno = 0;
+    while (fgets(line,sizeof(line),f)) {
+        ++lineno;
+        char *tok = strtok(line," \t\r\n");
+        if ((tok == NULL) || (tok[0] == '#')) continue;
+
+        if (!strcmp(tok,"v")) {
+            for (int i = 0; i < 3; ++i) {
+                char *c = strtok(NULL," \t\r\n");
+                Vertices.push_back(c ? atof(c) : 0);
+            }
+        } else if (!strcmp(tok,"f") || !strcmp(tok,"l") || !strcmp(tok,"e") || !strcmp(tok,"p")) {
+            std::vector<uint32_t> refs;
+            char *c;
+            while ((c = strtok(NULL," \t\r\n")) != NULL) {
+                uint32_t index;
+                if (!parseIndex(c,index)) {
+                    fprintf(stderr,"%s:%d: bad vertex index %s\n",path,lineno,c);
+                    fclose(f);
+                    return false;
+                }
+                refs.push_back(index);
+            }
+
+            if (tok[0] == 'p') {
+                Points.insert(Points.end(),refs.begin(),refs.end());
+            } else {
+                for (size_t i = 1; i < refs.size(); ++i) addEdge(refs[i-1],refs[i]);
+                if ((tok[0] == 'f') && (refs.size() > 2)) addEdge(refs.back(),refs[0]);
+            }
+        }
+    }
+
+    fclose(f);
+    return true;
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Strips															*/
+/*                                                                  */
+/********************************************************************/
+
+/*	buildStrips
+ *
+ *		Chain the edges into as few strips of connected vertices as
+ *	possible. A connected set of edges with k vertices of odd degree
+ *	needs at least k/2 strips (or one, if k is 0), since every strip
+ *	must start or end at an odd vertex. We reach that by joining all but
+ *	two of the odd vertices in pairs with dummy edges, finding a path
+ *	through every edge (an Eulerian path) with Hierholzer's algorithm,
+ *	then cutting the path at the dummy edges.
+ */
+
+static std::vector<std::vector<uint32_t> > buildStrips()
+{
+    uint32_t n = Vertices.size() / 3;
+    std::vector<std::pair<uint32_t,uint32_t> > edges(Edges);
+    size_t real = edges.size();
+
+    std::vector<std::vector<uint32_t> > adj(n);
+    for (size_t e = 0; e < real; ++e) {
+        adj[edges[e].first].push_back(e);
+        adj[edges[e].second].push_back(e);
+    }
+
+    std::vector<std::vector<uint32_t> > strips;
+    std::vector<bool> seen(n,false);
+    std::vector<bool> used;
+    std::vector<size_t> next(n,0);
+
+    for (uint32_t root = 0; root < n; ++root) {
+        if (seen[root] || adj[root].empty()) continue;
+
+        /*
+         *  Find this connected set of edges and its odd vertices
+         */
+
+        std::vector<uint32_t> odd;
+        std::vector<uint32_t> queue(1,root);
+        seen[root] = true;
+        for (size_t q = 0; q < queue.size(); ++q) {
+            uint32_t v = queue[q];
+            if (adj[v].size() & 1) odd.push_back(v);
+            for (size_t i = 0; i < adj[v].size(); ++i) {
+                const std::pair<uint32_t,uint32_t> &e = edges[adj[v][i]];
+                uint32_t w = (e.first == v) ? e.second : e.first;
+                if (!seen[w]) {
+                    seen[w] = true;
+                    queue.push_back(w);
+                }
+            }
+        }
+
+        uint32_t start = odd.empty() ? root : odd[0];
+        for (size_t i = 1; i + 1 < odd.size(); i += 2) {
+            adj[odd[i]].push_back(edges.size());
+            adj[odd[i+1]].push_back(edges.size());
+            edges.push_back(std::make_pair(odd[i],odd[i+1]));
+        }
+        used.resize(edges.size(),false);
+
+        /*
+         *  Hierholzer's algorithm. Vertices come off the stack in path
+         *  order (reversed), each with the edge to the next one.
+         */
+
+        std::vector<std::pair<uint32_t,size_t> > stack(1,std::make_pair(start,(size_t)-1));
+        std::vector<std::pair<uint32_t,size_t> > path;
+        while (!stack.empty()) {
+            uint32_t v = stack.back().first;
+            while ((next[v] < adj[v].size()) && used[adj[v][next[v]]]) ++next[v];
+            if (next[v] < adj[v].size()) {
+                size_t e = adj[v][next[v]++];
+                used[e] = true;
+                uint32_t w = (edges[e].first == v) ? edges[e].second : edges[e].first;
+                stack.push_back(std::make_pair(w,e));
+            } else {
+                path.push_back(stack.back());
+                stack.pop_back();
+            }
+        }
+
+        std::vector<uint32_t> strip(1,path[0].first);
+        for (size_t i = 0; i + 1 < path.size(); ++i) {
+            if (path[i].second >= real) {
+                strips.push_back(strip);
+                strip.clear();
+            }
+            strip.push_back(path[i+1].first);
+        }
+        strips.push_back(strip);
+    }
+
+    /*
+     *  A strip may pass through a vertex many times, so split any which
+     *  are too long for their 16-bit count
+     */
+
+    for (size_t i = 0; i < strips.size(); ++i) {
+        if (strips[i].size() > 0xFFFF) {
+            std::vector<uint32_t> rest(strips[i].begin() + 0xFFFE,strips[i].end());
+            strips[i].resize(0xFFFF);
+            strips.push_back(rest);
+        }
+    }
+
+    for (size_t i = 0; i < Points.size(); ++i) {
+        strips.push_back(std::vector<uint32_t>(1,Points[i]));
+    }
+    return strips;
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Output															*/
+/*                                                                  */
+/********************************************************************/
+
+static void put16(std::vector<uint8_t> &out, uint16_t v)
+{
+    out.push_back(v & 0xFF);
+    out.push_back(v >> 8);
+}
+
+/*	encode
+ *
+ *		Quantize the vertices used by the strips and write the compact
+ *	mesh. Unused vertices are dropped.
+ */
+
+static bool encode(const std::vector<std::vector<uint32_t> > &strips, bool word, std::vector<uint8_t> &out)
+{
+    std::vector<int32_t> remap(Vertices.size() / 3,-1);
+    std::vector<uint32_t> order;
+    for (size_t s = 0; s < strips.size(); ++s) {
+        for (size_t i = 0; i < strips[s].size(); ++i) {
+            uint32_t v = strips[s][i];
+            if (remap[v] < 0) {
+                remap[v] = order.size();
+                order.push_back(v);
+            }
+        }
+    }
+
+    if ((order.size() > 0xFFFF) || (strips.size() > 0xFFFF)) {
+        fprintf(stderr,"Model too large: %zu vertices, %zu strips\n",order.size(),strips.size());
+        return false;
+    }
+
+    float extent = 0;
+    for (size_t i = 0; i < order.size(); ++i) {
+        for (int j = 0; j < 3; ++j) {
+            extent = std::max(extent,(float)fabs(Vertices[3*order[i]+j]));
+        }
+    }
+    int limit = word ? 32767 : 127;
+    float scale = (extent > 0) ? extent / limit : 1;
+    bool wideIndex = order.size() > 256;
+
+    out.push_back('G');
+    out.push_back('3');
+    out.push_back('M');
+    out.push_back(G3D_COMPACT_VERSION);
+    out.push_back((word ? G3D_COMPACT_WORD : 0) | (wideIndex ? G3D_COMPACT_WIDEINDEX : 0));
+    out.push_back(0);
+    put16(out,order.size());
+    put16(out,strips.size());
+    put16(out,0);
+    uint8_t raw[4];
+    memcpy(raw,&scale,4);
+    out.insert(out.end(),raw,raw + 4);
+
+    for (size_t i = 0; i < order.size(); ++i) {
+        for (int j = 0; j < 3; ++j) {
+            long q = lround(Vertices[3*order[i]+j] / scale);
+            if (q > limit) q = limit;
+            if (q < -limit) q = -limit;
+            if (word) {
+                put16(out,(uint16_t)(int16_t)q);
+            } else {
+                out.push_back((uint8_t)(int8_t)q);
+            }
+        }
+    }
+
+    for (size_t s = 0; s < strips.size(); ++s) {
+        put16(out,strips[s].size());
+        for (size_t i = 0; i < strips[s].size(); ++i) {
+            uint32_t v = remap[strips[s][i]];
+            if (wideIndex) {
+                put16(out,v);
+            } else {
+                out.push_back(v);
+            }
+        }
+    }
+    return true;
+}
+
+/*	writeSource
+ *
+ *		Write the mesh as a PROGMEM array for a sketch
+ */
+
+static void writeSource(FILE *f, const char *name, const std::vector<uint8_t> &data)
+{
+    fprintf(f,"// Compact mesh; draw with G3D::drawCompactMesh_P\n");
+    fprintf(f,"const uint8_t %s[%zu] PROGMEM = {",name,data.size());
+    for (size_t i = 0; i < data.size(); ++i) {
+        fprintf(f,"%s0x%02X",(i % 12) ? ", " : (i ? ",\n    " : "\n    "),data[i]);
+    }
+    fprintf(f,"\n};\n");
+}
+
+/********************************************************************/
+/*                                                                  */
+/*  Main															*/
+/*                                                                  */
+/********************************************************************/
+
+static void usage()
+{
+    fprintf(stderr,"usage: g3dmesh [-8] [-c name] model.obj output\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    bool word = true;
+    const char *name = NULL;
+    const char *input = NULL;
+    const char *output = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i],"-8")) {
+            word = false;
+        } else if (!strcmp(argv[i],"-c") && (i+1 < argc)) {
+            name = argv[++i];
+        } else if (argv[i][0] == '-') {
+            usage();
+        } else if (input == NULL) {
+            input = argv[i];
+        } else if (output == NULL) {
+            output = argv[i];
+        } else {
+            usage();
+        }
+    }
+    if (output == NULL) usage();
+
+    if (!readModel(input)) {
+        fprintf(stderr,"Unable to read %s\n",input);
+        return 1;
+    }
+
+    /*
+     *  Drawing the edges in input order takes a move for each edge which
+     *  does not continue the last, and a transform for every move and
+     *  draw. Compare that with the strips.
+     */
+
+    long inputStrips = 0;
+    long inputTransforms = 0;
+    uint32_t last = 0xFFFFFFFF;
+    for (size_t i = 0; i < Edges.size(); ++i) {
+        if (Edges[i].first != last) {
+            ++inputStrips;
+            ++inputTransforms;
+        }
+        ++inputTransforms;
+        last = Edges[i].second;
+    }
+
+    std::vector<std::vector<uint32_t> > strips = buildStrips();
+    long stripTransforms = 0;
+    for (size_t i = 0; i < strips.size(); ++i) stripTransforms += strips[i].size();
+    std::vector<uint8_t> data;
+    if (!encode(strips,word,data)) return 1;
+
+    FILE *f = fopen(output,name ? "w" : "wb");
+    if (f == NULL) {
+        fprintf(stderr,"Unable to write %s\n",output);
+        return 1;
+    }
+    if (name) {
+        writeSource(f,name,data);
+    } else {
+        fwrite(data.data(),1,data.size(),f);
+    }
+    fclose(f);
+
+    fprintf(stderr,"%zu edges, %zu bytes\n",Edges.size(),data.size());
+    fprintf(stderr,"input order: %ld strips, %ld transforms\n",inputStrips,inputTransforms + (long)Points.size());
+    fprintf(stderr,"stripped:    %zu strips, %ld transforms\n",strips.size(),stripTransforms);
+    return 0;
+}